@@ -0,0 +1,44 @@
+/*
+ * Static analysis of code with the scheduling model of the target.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_ANALYZER_H
+#define ASMASE_ANALYZER_H
+
+class AssemblerContext;
+class CodeRun;
+
+/**
+ * Analyze code that was run on the tracee with the scheduling model of the
+ * target CPU and print a report: the predicted reciprocal throughput of the
+ * code as a loop body, the pressure on each processor resource, the critical
+ * dependency chains, and a timeline for the given number of iterations. The
+ * measurements of the run are printed next to the predictions.
+ *
+ * This is in the spirit of llvm-mca but much simpler: instructions are
+ * dispatched in order and issued out of order as soon as their operands and
+ * resources are ready, only register dependencies are considered, and the
+ * reorder buffer and retirement aren't modeled.
+ * @return Zero on success, nonzero on failure.
+ */
+int analyzeCode(const AssemblerContext &context, const CodeRun &run,
+                unsigned int iterations);
+
+#endif /* ASMASE_ANALYZER_H */
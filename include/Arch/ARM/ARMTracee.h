@@ -22,19 +22,31 @@
 #ifndef ASMASE_ARCH_ARM_ARMTRACEE_H
 #define ASMASE_ARCH_ARM_ARMTRACEE_H
 
+#include <sys/user.h>
+
 #include "Tracee.h"
 
 class ARMTracee : public Tracee {
+    /** Registers saved while injecting a system call. */
+    struct user_regs savedRegisters;
+
     virtual const bytestring &getTrapInstruction();
+    virtual const bytestring &getSyscallInstruction();
 
     virtual int setProgramCounter(void *pc);
     virtual int updateRegisters();
 
+    virtual int saveRegisters();
+    virtual int restoreRegisters();
+    virtual int setSyscallRegisters(long number, const std::vector<long> &args);
+    virtual int getSyscallResult(long &result);
+
     virtual int printGeneralPurposeRegisters();
     virtual int printConditionCodeRegisters();
 
 public:
-    ARMTracee(pid_t pid, void *sharedMemory, size_t sharedSize);
+    ARMTracee(pid_t pid, void *sharedMemory, size_t sharedSize,
+              void *arena, size_t arenaSize);
 
     virtual void printInstruction(const bytestring &machineCode);
 };
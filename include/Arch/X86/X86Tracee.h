@@ -22,14 +22,25 @@
 #ifndef ASMASE_ARCH_X86_X86TRACEE_H
 #define ASMASE_ARCH_X86_X86TRACEE_H
 
+#include <sys/user.h>
+
 #include "Tracee.h"
 
 class X86Tracee : public Tracee {
+    /** Registers saved while injecting a system call. */
+    struct user_regs_struct savedRegisters;
+
     virtual const bytestring &getTrapInstruction();
+    virtual const bytestring &getSyscallInstruction();
 
     virtual int setProgramCounter(void *pc);
     virtual int updateRegisters();
 
+    virtual int saveRegisters();
+    virtual int restoreRegisters();
+    virtual int setSyscallRegisters(long number, const std::vector<long> &args);
+    virtual int getSyscallResult(long &result);
+
     virtual int printGeneralPurposeRegisters();
     virtual int printConditionCodeRegisters();
     virtual int printSegmentationRegisters();
@@ -44,7 +55,8 @@ class X86Tracee : public Tracee {
     void reconstructTagWord();
 
 public:
-    X86Tracee(pid_t pid, void *sharedMemory, size_t sharedSize);
+    X86Tracee(pid_t pid, void *sharedMemory, size_t sharedSize,
+              void *arena, size_t arenaSize);
 };
 
 #endif /* ASMASE_ARCH_X86_X86TRACEE_H */
@@ -22,8 +22,17 @@
 #ifndef ASMASE_ASSEMBLER_H
 #define ASMASE_ASSEMBLER_H
 
+#include <cstdint>
+#include <future>
+#include <list>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "Prelude.h"
+#include "ScriptCache.h"
 #include "Support.h"
 
 class Inputter;
@@ -31,30 +40,303 @@ class Inputter;
 /** Opaque handle for an assembler context. */
 class AssemblerContext;
 
+/** MC layer state which is reused between instructions. */
+class AssemblerPipeline;
+
 /** Class providing assembly of individual instructions. */
 class Assembler {
-    /** The assembler context for this assembler. */
-    const std::shared_ptr<AssemblerContext> context;
+    /**
+     * The assembler context for this assembler, which may still be being
+     * created in the background.
+     */
+    std::shared_future<std::shared_ptr<AssemblerContext>> contextFuture;
+
+    /**
+     * The assembler context once it is ready. Anything which needs it must
+     * call waitForContext() first.
+     */
+    std::shared_ptr<AssemblerContext> context;
+
+    /**
+     * The pipeline used to assemble instructions. This is created lazily and
+     * reset between instructions instead of being rebuilt for each one.
+     */
+    std::unique_ptr<AssemblerPipeline> pipeline;
+
+    /**
+     * Cache of machine code for previously assembled instructions, keyed by
+     * the normalized instruction and target. The most recently used entry is
+     * at the front.
+     */
+    std::list<std::pair<std::string, bytestring>> cache;
+
+    /** Index into the cache by key. */
+    std::unordered_map<std::string,
+                       std::list<std::pair<std::string, bytestring>>::iterator>
+        cacheIndex;
+
+    /** Cache statistics. */
+    size_t cacheHits, cacheMisses;
+
+    /** Pre-assembled scripts, keyed by filename. */
+    std::unordered_map<std::string, ScriptCache> scripts;
+
+    /** Lines of a script which are being assembled in the background. */
+    class PendingScript;
+
+    /**
+     * Scripts which are still being pre-assembled, keyed by filename. Once
+     * all of their lines are done, they are moved into scripts.
+     */
+    std::unordered_map<std::string, std::unique_ptr<PendingScript>>
+        pendingScripts;
+
+    /** Addresses of the labels defined so far, keyed by name. */
+    std::unordered_map<std::string, uint64_t> labels;
+
+    /** Macros and symbol assignments defined so far. */
+    Prelude prelude;
+
+    /** Whether a block is being collected. */
+    bool blockOpen;
+
+    /** Whether a block has been collected and is ready to be assembled. */
+    bool blockReady;
+
+    /**
+     * Whether the block being collected was started implicitly by an
+     * unterminated .macro, .rept, etc. rather than by beginBlock().
+     */
+    bool blockImplicit;
+
+    /** Nesting depth of an implicit block. */
+    int blockNesting;
+
+    /** Source of the block being collected. */
+    std::string block;
+
+    /** Line number of the first line in the block being collected. */
+    int blockLineno;
+
+    /**
+     * Assemble an instruction using the cache but not the pre-assembled
+     * scripts. If inputter is nullptr, diagnostics are not printed, and labels
+     * aren't defined.
+     * @return Zero on success, nonzero on failure.
+     */
+    int assembleCached(const std::string &instruction, uint64_t address,
+                       uint64_t dataEnd, bytestring &machineCodeOut,
+                       std::vector<DataSection> &sectionsOut,
+                       const Inputter *inputter);
+
+    /**
+     * Assemble source with LLVM, bypassing the cache. Diagnostics are
+     * reported starting at line number lineno. If inputter is nullptr,
+     * diagnostics are not printed, and labels aren't defined.
+     * @param cacheableOut Set to whether the result is independent of address
+     * and can be reused.
+     * @return Zero on success, nonzero on failure.
+     */
+    int assembleUncached(const std::string &source, uint64_t address,
+                         uint64_t dataEnd, bytestring &machineCodeOut,
+                         std::vector<DataSection> &sectionsOut,
+                         bool &cacheableOut, const Inputter *inputter,
+                         int lineno);
+
+    /** Get a hash identifying the target and LLVM version. */
+    uint64_t getTargetHash() const;
+
+    /**
+     * Get the cache key for an instruction assembled with the definitions with
+     * the given hash.
+     */
+    std::string getCacheKey(const std::string &instruction,
+                            uint64_t preludeHash) const;
+
+    /** A line of a script to pre-assemble. */
+    class ScriptLine {
+    public:
+        int lineno;
+        std::string text;
+
+        /** Hash and size of the prelude for this line. */
+        uint64_t preludeHash;
+        size_t preludeSize;
+
+        /**
+         * Whether a worker has finished with the line (protected by the
+         * PendingScript's mutex).
+         */
+        bool done;
+
+        /** Whether the line was assembled successfully. */
+        bool assembled;
+        bytestring machineCode;
+
+        ScriptLine(int lineno, std::string text, uint64_t preludeHash,
+                   size_t preludeSize)
+            : lineno{lineno}, text{std::move(text)}, preludeHash{preludeHash},
+              preludeSize{preludeSize}, done{false}, assembled{false} {}
+    };
+
+    /**
+     * Start assembling the lines of a script in parallel in the background,
+     * using a pipeline per thread. The lines are handed out in order, so the
+     * first lines are ready first.
+     */
+    void startScriptWorkers(PendingScript &pending);
+
+    /**
+     * Look up a line of a script which is being assembled in the background,
+     * waiting for it if it isn't ready yet. When every line is done, the
+     * results are moved into the script's cache and saved.
+     * @return nullptr if the line wasn't pre-assembled.
+     */
+    const bytestring *lookupPendingLine(const std::string &filename,
+                                        int lineno,
+                                        const std::string &instruction);
+
+    /**
+     * Wait for the background assembly of a script to finish and move the
+     * results into the script's cache.
+     */
+    void finishScript(const std::string &filename);
+
+    /** Wait for the assembler context to be created if it hasn't been yet. */
+    void waitForContext();
 
 public:
-    /** Create an assembler in the given context. */
-    Assembler(std::shared_ptr<AssemblerContext> &context)
-        : context{context} {}
+    /** The maximum number of instructions to cache. */
+    static const size_t CACHE_CAPACITY = 4096;
+
+    /**
+     * Create an assembler in the given context. The context can still be
+     * being created (see createAssemblerContextAsync()); the assembler only
+     * waits for it when it needs it, so built-ins which don't use the
+     * assembler aren't held up.
+     */
+    Assembler(std::shared_future<std::shared_ptr<AssemblerContext>> context);
+    ~Assembler();
 
     /**
-     * Assemble the given assembly instruction to machine code.
+     * Assemble the given assembly instruction to machine code which will be
+     * placed at the given address. Any other sections (e.g., .data or
+     * .rodata) are placed right below dataEnd and returned in sectionsOut;
+     * they must be loaded at those addresses before the code is run. Labels
+     * defined by the instruction are added to the symbol table, and
+     * references to labels and sections are resolved. Instructions which were
+     * assembled successfully before are returned from the cache or from the
+     * pre-assembled script that the inputter is reading from.
      * @return Zero on success, nonzero on failure.
      */
-    int assembleInstruction(const std::string &instruction,
-                            bytestring &machineCodeOut,
+    int assembleInstruction(const std::string &instruction, uint64_t address,
+                            uint64_t dataEnd, bytestring &machineCodeOut,
+                            std::vector<DataSection> &sectionsOut,
                             const Inputter &inputter);
 
+    /**
+     * Start collecting lines into a block. A block is assembled as a single
+     * unit, so it can contain forward references to labels.
+     */
+    void beginBlock(int lineno);
+
+    /**
+     * Return whether the given line starts a multi-line construct (e.g.,
+     * .macro or .rept) which it doesn't finish. In that case, the line should
+     * be passed to beginImplicitBlock() instead of being assembled, and the
+     * block is ready once the construct is finished.
+     */
+    bool opensBlock(const std::string &line);
+
+    /** Start collecting lines into a block with the given first line. */
+    void beginImplicitBlock(const std::string &line, int lineno);
+
+    /** Return whether a block is being collected. */
+    bool inBlock() const { return blockOpen; }
+
+    /** Add a line to the block being collected. */
+    void addBlockLine(const std::string &line);
+
+    /** Finish collecting a block started with beginBlock(). */
+    void endBlock();
+
+    /** Return whether a block is ready to be assembled with assembleBlock(). */
+    bool isBlockReady() const { return blockReady; }
+
+    /**
+     * Assemble the collected block like assembleInstruction().
+     * @return Zero on success, nonzero on failure.
+     */
+    int assembleBlock(uint64_t address, uint64_t dataEnd,
+                      bytestring &machineCodeOut,
+                      std::vector<DataSection> &sectionsOut,
+                      const Inputter &inputter);
+
+    /** Get the labels defined so far. */
+    const std::unordered_map<std::string, uint64_t> &getLabels() const
+    {
+        return labels;
+    }
+
+    /**
+     * Forget the labels defined so far, e.g., because the code they point to
+     * is gone.
+     */
+    void clearLabels() { labels.clear(); }
+
+    size_t getCacheHits() const { return cacheHits; }
+    size_t getCacheMisses() const { return cacheMisses; }
+    size_t getCacheSize() const { return cache.size(); }
+
+    /** Empty the cache and reset the statistics. */
+    void clearCache();
+
+    /**
+     * Pre-assemble all of the lines in a script (except for built-ins) so that
+     * assembleInstruction() doesn't need to do any work when the script is
+     * run. The assembly happens in the background, so the script can start
+     * running right away; assembleInstruction() only waits if it gets ahead
+     * of the workers. The result is saved on disk once it's complete, and
+     * later calls for an unchanged script load it instead of assembling
+     * anything. Lines which fail to assemble are skipped; they are assembled
+     * again when they are run so that errors are reported normally.
+     * @return Zero on success, nonzero on failure.
+     */
+    int loadScript(const std::string &filename);
+
+    /** Get the target triple. */
+    const std::string &getTriple();
+
+    /** Get the target CPU. */
+    const std::string &getCPU();
+
+    /** Get the target features as a comma-separated list. */
+    const std::string &getFeatures();
+
+    /**
+     * Get the assembler context, e.g., for disassembling with the same target
+     * (see AssemblerContext.h).
+     */
+    const AssemblerContext &getContext();
+
     /**
      * Create an assembler context which can be used to construct an
-     * assembler.
+     * assembler. If cpu is empty, the host CPU and its features are detected
+     * and used. features is a comma-separated list of +feature or -feature
+     * which is applied on top of that.
      * @return nullptr on error.
      */
-    static std::shared_ptr<AssemblerContext> createAssemblerContext();
+    static std::shared_ptr<AssemblerContext>
+    createAssemblerContext(const std::string &cpu = "",
+                           const std::string &features = "");
+
+    /**
+     * Start creating an assembler context on a background thread. Setting up
+     * LLVM takes a while, so this lets it overlap with waiting for input.
+     */
+    static std::shared_future<std::shared_ptr<AssemblerContext>>
+    createAssemblerContextAsync(const std::string &cpu = "",
+                                const std::string &features = "");
 };
 
 #endif /* ASMASE_ASSEMBLER_H */
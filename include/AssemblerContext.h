@@ -0,0 +1,69 @@
+/*
+ * LLVM state shared by everything which uses the target.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_ASSEMBLER_CONTEXT_H
+#define ASMASE_ASSEMBLER_CONTEXT_H
+
+#include <memory>
+#include <string>
+
+#include <llvm/ADT/Triple.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/MC/MCAsmInfo.h>
+#include <llvm/MC/MCInstrInfo.h>
+#include <llvm/MC/MCRegisterInfo.h>
+#include <llvm/Support/TargetRegistry.h>
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 5)
+#define OwningPtr std::unique_ptr
+#else
+#include <llvm/ADT/OwningPtr.h>
+using llvm::OwningPtr;
+#endif
+
+namespace llvm {
+class MCSubtargetInfo;
+}
+
+/**
+ * Context storing LLVM state that can be reused. This is only read after it
+ * is created, so it can be shared between threads.
+ */
+class AssemblerContext {
+    static bool llvmIsInit;
+
+public:
+    std::string tripleName;
+    llvm::Triple triple;
+    std::string cpu;
+    std::string features;
+    const llvm::Target *target;
+    OwningPtr<llvm::MCRegisterInfo> registerInfo;
+    OwningPtr<llvm::MCAsmInfo> asmInfo;
+    OwningPtr<llvm::MCInstrInfo> instrInfo;
+
+    AssemblerContext(const std::string &cpu, const std::string &features);
+
+    /** Create subtarget info for the CPU and features. */
+    llvm::MCSubtargetInfo *createSubtargetInfo() const;
+};
+
+#endif /* ASMASE_ASSEMBLER_CONTEXT_H */
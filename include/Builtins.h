@@ -22,7 +22,9 @@
 #ifndef ASMASE_BUILTINS_H
 #define ASMASE_BUILTINS_H
 
+class Assembler;
 class Inputter;
+class JsonWriter;
 class Tracee;
 
 /**
@@ -31,10 +33,24 @@ class Tracee;
  */
 bool isBuiltin(const std::string &str);
 
+/** Returned by runBuiltin() when the user asks to quit. */
+static const int BUILTIN_QUIT = -2;
+
+/**
+ * Returned by runBuiltin() when the user asks to replace the tracee with a
+ * fresh one.
+ */
+static const int BUILTIN_RESET = -3;
+
 /**
  * Run a command line built-in.
- * @return Positive on error, 0 on success, negative on exit.
+ * @param json If not nullptr, the built-in's results are also written as
+ * members of the JSON object which is currently open.
+ * @return Positive on error, 0 on success, negative on exit (BUILTIN_QUIT if
+ * the user asked to quit, BUILTIN_RESET if the caller should reset the tracee,
+ * anything else on a fatal error).
  */
-int runBuiltin(const std::string &str, Tracee &tracee, Inputter &inputter);
+int runBuiltin(const std::string &str, Tracee &tracee, Assembler &assembler,
+               Inputter &inputter, JsonWriter *json = nullptr);
 
 #endif /* ASMASE_BUILTINS_H */
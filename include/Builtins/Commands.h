@@ -45,6 +45,20 @@ typedef int (*BuiltinFunc)(const std::vector<std::unique_ptr<Builtins::ValueAST>
 BUILTIN_FUNC(print);
 BUILTIN_FUNC(source);
 BUILTIN_FUNC(memory);
+BUILTIN_FUNC(write);
+BUILTIN_FUNC(fill);
+BUILTIN_FUNC(fill_random);
+BUILTIN_FUNC(alloc);
+BUILTIN_FUNC(free);
+BUILTIN_FUNC(load);
+BUILTIN_FUNC(cache);
+BUILTIN_FUNC(begin);
+BUILTIN_FUNC(end);
+BUILTIN_FUNC(labels);
+BUILTIN_FUNC(target);
+BUILTIN_FUNC(analyze);
+BUILTIN_FUNC(disas);
+BUILTIN_FUNC(encodings);
 BUILTIN_FUNC(registers);
 BUILTIN_FUNC(warranty);
 BUILTIN_FUNC(copying);
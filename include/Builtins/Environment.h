@@ -25,8 +25,10 @@
 #include <string>
 #include <sys/types.h>
 
+class Assembler;
 class Tracee;
 class Inputter;
+class JsonWriter;
 
 namespace Builtins {
 
@@ -38,14 +40,26 @@ class Environment {
 public:
     Tracee &tracee;
 
+    /** Assembler used for assembly input. */
+    Assembler &assembler;
+
     /** Inputter which gave us the input being run. */
     Inputter &inputter;
 
     /** Error context for the input being run. */
     ErrorContext &errorContext;
 
-    Environment(Tracee &tracee, Inputter &inputter, ErrorContext &errorContext)
-        : tracee(tracee), inputter(inputter), errorContext(errorContext) {}
+    /**
+     * Writer for machine-readable output, or nullptr if output is only for
+     * humans. Commands with structured results write them as members of the
+     * JSON object which is open.
+     */
+    JsonWriter *json;
+
+    Environment(Tracee &tracee, Assembler &assembler, Inputter &inputter,
+                ErrorContext &errorContext, JsonWriter *json = nullptr)
+        : tracee(tracee), assembler(assembler), inputter(inputter),
+          errorContext(errorContext), json{json} {}
 
     /**
      * Look up a variable in the environment.
@@ -23,6 +23,7 @@
 #define ASMASE_BUILTINS_SUPPORT_H
 
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace Builtins {
@@ -55,6 +56,12 @@ bool checkValueType(const ValueAST &value, ValueType type,
 
 bool wantsHelp(const std::vector<std::unique_ptr<ValueAST>> &args);
 
+/**
+ * Look up a unit size specifier (b, h, w, or g).
+ * @return The represented size in bytes, or zero if the specifier is invalid.
+ */
+size_t lookupSizeSpecifier(const std::string &sizeStr);
+
 /** Return the escaped version of a character. */
 std::string escapeCharacter(char c,
     bool escapeSingleQuote = false, bool escapeDoubleQuote = false,
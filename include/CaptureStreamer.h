@@ -0,0 +1,109 @@
+/*
+ * Streamer which captures machine code without writing an object file.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_CAPTURE_STREAMER_H
+#define ASMASE_CAPTURE_STREAMER_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/SMLoc.h>
+
+#include "Support.h"
+
+/** State shared between the assembler and a capture streamer. */
+class CaptureState {
+public:
+    /** Address that the start of the text section will be loaded at. */
+    uint64_t address;
+
+    /**
+     * Address that other sections are placed below, or zero if they can't be
+     * placed.
+     */
+    uint64_t dataEnd;
+
+    /** Addresses of symbols defined by earlier code, or nullptr if none. */
+    const std::unordered_map<std::string, uint64_t> *labels;
+
+    /** Symbols defined in the text section and their addresses. */
+    std::vector<std::pair<std::string, uint64_t>> definedSymbols;
+
+    /** References to symbols which aren't defined anywhere. */
+    std::vector<std::pair<std::string, llvm::SMLoc>> undefinedSymbols;
+
+    /** Sections other than the text section which were placed. */
+    std::vector<DataSection> sections;
+
+    /**
+     * Whether the machine code depends on the address it was assembled for or
+     * defines symbols, in which case it can't be reused.
+     */
+    bool addressDependent;
+
+    CaptureState()
+        : address{0}, dataEnd{0}, labels{nullptr}, addressDependent{false} {}
+
+    /** Forget the results of the last run. */
+    void clear()
+    {
+        definedSymbols.clear();
+        undefinedSymbols.clear();
+        sections.clear();
+        addressDependent = false;
+    }
+};
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+
+namespace llvm {
+class MCAsmBackend;
+class MCCodeEmitter;
+class MCContext;
+class MCStreamer;
+class raw_pwrite_stream;
+}
+
+/**
+ * Create a streamer which writes the raw contents of the text section to the
+ * given output stream when it is finished instead of writing an ELF object
+ * file. Everything up to the object writer (fragment layout, relaxation, and
+ * fixups) is the same as the ELF streamer. Other sections are placed below
+ * state.dataEnd and their contents are returned in state.sections. Instead of
+ * emitting relocations, fixups are resolved against the section addresses and
+ * state.labels, and the results of the run are recorded in the state.
+ *
+ * The streamer takes ownership of the backend and code emitter.
+ */
+llvm::MCStreamer *createCaptureStreamer(llvm::MCContext &context,
+                                        llvm::MCAsmBackend *backend,
+                                        llvm::raw_pwrite_stream &OS,
+                                        llvm::MCCodeEmitter *codeEmitter,
+                                        bool isLittleEndian,
+                                        CaptureState &state);
+
+#endif
+
+#endif /* ASMASE_CAPTURE_STREAMER_H */
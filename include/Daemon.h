@@ -0,0 +1,101 @@
+/*
+ * Daemon which runs input for clients with a warm assembler and tracees.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_DAEMON_H
+#define ASMASE_DAEMON_H
+
+#include <string>
+
+/**
+ * Non-interactive input for the daemon to run on behalf of a client, which is
+ * run as if the client had run it itself.
+ */
+class DaemonRequest {
+public:
+    /** Target the client wants to assemble for (see --mcpu and --mattr). */
+    std::string cpu, features;
+
+    /** Script to run (see -f), or empty if commands are given. */
+    std::string scriptFile;
+
+    /** Lines to run, each ending with a newline (see -e). */
+    std::string commands;
+
+    /** Whether the client wants JSON output (see --output). */
+    bool jsonOutput;
+
+    DaemonRequest() : jsonOutput{false} {}
+};
+
+/**
+ * Get the default path of the daemon's socket: $XDG_RUNTIME_DIR/asmase.sock,
+ * or a per-user path in /tmp if that isn't set.
+ */
+std::string getDefaultSocketPath();
+
+/**
+ * Run the daemon: listen on the given socket and run requests from clients
+ * with the same user ID until killed. The assembler context is created once up
+ * front, and each request is run concurrently in a process forked from the
+ * daemon ahead of time, along with its spare tracees, so a request pays for
+ * none of that. Each request gets its own tracee and assembler state, runs in
+ * the client's working directory, and writes to the client's stdout and
+ * stderr, which are passed over the socket.
+ * @return The exit status on failure.
+ */
+int runDaemon(const std::string &socketPath, const std::string &cpu,
+              const std::string &features);
+
+/**
+ * Run requests from a single connected socket, such as one end of a socket
+ * pair, until it is closed. This is how a worker process in a pool (see
+ * runScripts()) serves the process which hands out its work.
+ * @return The exit status.
+ */
+int runDaemonWorker(int sock, const std::string &cpu,
+                    const std::string &features);
+
+/**
+ * Send a request on a connected socket, with output going to the given file
+ * descriptors, and wait for the daemon to accept it.
+ * @return Zero if the daemon is running the request, nonzero if it refused it
+ * or the connection failed.
+ */
+int startDaemonRequest(int sock, const DaemonRequest &request, int stdoutFd,
+                       int stderrFd);
+
+/**
+ * Wait for the exit status of a request started with startDaemonRequest().
+ * @return Zero on success, nonzero if the daemon went away first.
+ */
+int finishDaemonRequest(int sock, int &statusOut);
+
+/**
+ * Run a request on the daemon listening on the given socket.
+ * @return Zero if the daemon ran the request, in which case statusOut is the
+ * exit status; nonzero if there is no daemon or it can't run the request (for
+ * example, because it assembles for a different target), in which case the
+ * request should be run in-process.
+ */
+int runOnDaemon(const std::string &socketPath, const DaemonRequest &request,
+                int &statusOut);
+
+#endif /* ASMASE_DAEMON_H */
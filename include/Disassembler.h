@@ -0,0 +1,139 @@
+/*
+ * Disassembler class.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_DISASSEMBLER_H
+#define ASMASE_DISASSEMBLER_H
+
+#include <llvm/Config/llvm-config.h>
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/MC/MCInst.h>
+
+#include "Support.h"
+
+class AssemblerContext;
+
+namespace llvm {
+class MCCodeEmitter;
+class MCContext;
+class MCDisassembler;
+class MCInstPrinter;
+class MCSubtargetInfo;
+}
+
+/** An instruction decoded from machine code. */
+class DisassembledInstruction {
+public:
+    /** Address of the instruction. */
+    uint64_t address;
+
+    /** Encoding of the instruction. */
+    bytestring machineCode;
+
+    /** The decoded instruction; only meaningful if valid is set. */
+    llvm::MCInst inst;
+
+    /** Whether the bytes could be decoded. */
+    bool valid;
+};
+
+/** One way of encoding an instruction. */
+class InstructionEncoding {
+public:
+    /** Name of the opcode, e.g., ADD32ri8. */
+    std::string opcodeName;
+
+    bytestring machineCode;
+};
+
+/**
+ * Disassembler for the target of an assembler context. This is used to get
+ * MCInsts back for code that has already been assembled.
+ */
+class Disassembler {
+    const AssemblerContext &context;
+    std::unique_ptr<llvm::MCSubtargetInfo> subtargetInfo;
+    std::unique_ptr<llvm::MCContext> mcCtx;
+    std::unique_ptr<llvm::MCDisassembler> disassembler;
+    std::unique_ptr<llvm::MCInstPrinter> instPrinter;
+
+    /** Code emitter for re-encoding instructions, created when needed. */
+    std::unique_ptr<llvm::MCCodeEmitter> codeEmitter;
+
+public:
+    /** Create a disassembler. The context must outlive it. */
+    Disassembler(const AssemblerContext &context);
+    ~Disassembler();
+
+    const llvm::MCSubtargetInfo &getSubtargetInfo() const
+    {
+        return *subtargetInfo;
+    }
+
+    /** Get the length of the longest instruction for the target. */
+    unsigned int getMaxInstructionLength() const;
+
+    /**
+     * Decode the instruction at the given offset in machine code loaded at the
+     * given address. If the bytes can't be decoded, the result is a single
+     * invalid byte.
+     */
+    void decodeInstruction(const bytestring &machineCode, size_t offset,
+                           uint64_t address,
+                           DisassembledInstruction &instructionOut);
+
+    /**
+     * Decode machine code loaded at the given address. Bytes which can't be
+     * decoded are returned one at a time as invalid instructions.
+     */
+    void disassemble(const bytestring &machineCode, uint64_t address,
+                     std::vector<DisassembledInstruction> &instructionsOut);
+
+    /** Print an instruction in the assembler's syntax. */
+    std::string printInstruction(const llvm::MCInst &inst);
+
+    /**
+     * Encode an instruction.
+     * @return Zero on success, nonzero if the instruction needs fixups.
+     */
+    int encodeInstruction(const llvm::MCInst &inst, bytestring &machineCodeOut);
+
+    /**
+     * Find all of the ways to encode an instruction. These are the opcodes
+     * with compatible operands which print the same as the instruction and
+     * whose encoding decodes back to the same instruction. Encodings which
+     * are chosen by the code emitter rather than by the opcode (e.g., the
+     * size of a displacement) can't be found this way. The encodings are
+     * sorted by size.
+     */
+    void findEncodings(const llvm::MCInst &inst,
+                       std::vector<InstructionEncoding> &encodingsOut);
+};
+
+#endif
+
+#endif /* ASMASE_DISASSEMBLER_H */
@@ -28,17 +28,39 @@
 #include <utility>
 #include <vector>
 
-/** Class for reading line-by-line input from either a file or stdin. */
+#include "MappedFile.h"
+
+/**
+ * Class for reading line-by-line input from either a file or stdin. Input is
+ * either interactive, in which case stdin is read with readline, or batch, in
+ * which case it comes from a file (possibly stdin itself) and ends with it.
+ */
 class Inputter {
-    /** Input file and position in it. */
+    /**
+     * Input file and position in it. Regular files are mapped and read
+     * directly out of the mapping; anything else is read with getline().
+     */
     class InputFile {
     public:
         std::string filename;
         int lineno;
         FILE *file;
 
-        InputFile(const std::string &filename, int lineno, FILE *file)
-            : filename{filename}, lineno{lineno}, file{file} {}
+        /** Mapping of the file, if it could be mapped. */
+        MappedFile mapping;
+
+        /** Offset of the next line in the mapping. */
+        size_t offset;
+
+        InputFile(const std::string &filename, int lineno, FILE *file);
+
+        InputFile(InputFile &&other)
+            : filename{std::move(other.filename)}, lineno{other.lineno},
+              file{other.file}, mapping{std::move(other.mapping)},
+              offset{other.offset}
+        {
+            other.file = nullptr;
+        }
 
         ~InputFile()
         {
@@ -48,8 +70,9 @@ class Inputter {
     };
 
     /**
-     * Input file stack. The back is the current file and the front represents
-     * stdin.
+     * Input file stack. The back is the current file and the front is the
+     * base input, which represents stdin read with readline if its file is
+     * nullptr.
      */
     std::vector<InputFile> files;
 
@@ -63,9 +86,21 @@ public:
     /** The maximum depth of the redirection stack. */
     static const size_t MAX_FILES = 128;
 
+    /** Create an inputter which reads from stdin interactively. */
     Inputter();
+
+    /**
+     * Create an inputter for batch input from the given file, which the
+     * inputter takes ownership of. There is no prompt, line editing, or
+     * history.
+     */
+    Inputter(FILE *file, const std::string &filename);
+
     ~Inputter();
 
+    /** Return whether the input is interactive. */
+    bool isInteractive() const { return !files.front().file; }
+
     /**
      * Redirect input to read from the given filename.
      * @return Zero on success, nonzero on failure.
@@ -73,10 +108,13 @@ public:
     int redirectInput(const std::string &filename);
 
     /**
-     * Get a line from the current file. The newline character is included. On
-     * EOF of the last file or an error, an empty string is returned.
+     * Get a line from the current file, without the newline character. The
+     * line is assigned into lineOut so that its buffer is reused from line to
+     * line.
+     * @return true if a line was read, false on EOF of the base input or an
+     * error.
      */
-    std::string readLine(const std::string &prompt);
+    bool readLine(const std::string &prompt, std::string &lineOut);
 
     /** Return the name of the file we last read from. */
     const std::string &currentFilename() const;
@@ -0,0 +1,97 @@
+/*
+ * JsonWriter class.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_JSON_WRITER_H
+#define ASMASE_JSON_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+class RegisterValue;
+
+/**
+ * Writer for newline-delimited JSON (NDJSON) records. Values are streamed
+ * straight to a stdio stream, so the stream's buffering is the only buffering.
+ * Separators are inserted automatically; the caller only has to begin and end
+ * containers and give each member of an object a key first.
+ */
+class JsonWriter {
+    FILE *file;
+
+    /**
+     * Closing characters for the containers which are currently open,
+     * innermost last.
+     */
+    std::string open;
+
+    /** Whether the current container already has a member. */
+    bool needsComma;
+
+    /** Write a comma if a separator is needed before the next value. */
+    void separate();
+
+    /** Write a quoted, escaped string. */
+    void writeString(const char *str, size_t size);
+
+public:
+    explicit JsonWriter(FILE *file) : file{file}, needsComma{false} {}
+
+    void beginObject();
+    void endObject();
+    void beginArray();
+    void endArray();
+
+    /** Write the key for the next member of an object. */
+    void key(const char *name);
+
+    void stringValue(const std::string &str);
+    void stringValue(const char *str);
+    void uintValue(uint64_t value);
+    void intValue(int64_t value);
+
+    /** Write a number. Infinities and NaNs are written as strings. */
+    void doubleValue(long double value);
+
+    void boolValue(bool value);
+    void nullValue();
+
+    /** Write an integer as a hexadecimal string so that no precision is lost. */
+    void hexValue(uint64_t value);
+
+    /** Write bytes as a string of hexadecimal digits. */
+    void bytesValue(const unsigned char *bytes, size_t size);
+
+    /**
+     * Write a register value: integers as hexadecimal strings and floating
+     * point values as numbers.
+     */
+    void registerValue(const RegisterValue &value);
+
+    /**
+     * Finish a record, closing any containers which are still open (e.g.,
+     * because a command failed partway through), and end the line.
+     */
+    void endRecord();
+};
+
+#endif /* ASMASE_JSON_WRITER_H */
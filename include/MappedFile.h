@@ -0,0 +1,72 @@
+/*
+ * MappedFile class.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_MAPPED_FILE_H
+#define ASMASE_MAPPED_FILE_H
+
+#include <cstddef>
+
+/**
+ * Read-only memory mapping of a whole file, which lets the file be read
+ * without copying it through stdio buffers. Only non-empty regular files can
+ * be mapped; anything else (pipes, terminals, etc.) has to be read normally.
+ * The file shouldn't be truncated while it is mapped.
+ */
+class MappedFile {
+    /** Start of the mapping, or nullptr if nothing is mapped. */
+    const char *address;
+
+    /** Size of the mapping. */
+    size_t length;
+
+public:
+    MappedFile() : address{nullptr}, length{0} {}
+    ~MappedFile();
+
+    MappedFile(MappedFile &&other)
+        : address{other.address}, length{other.length}
+    {
+        other.address = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    /**
+     * Map the file open on the given file descriptor. The descriptor can be
+     * closed afterwards.
+     * @return Zero on success, nonzero on failure (including if the file isn't
+     * a non-empty regular file).
+     */
+    int map(int fd);
+
+    /** Return whether a file is mapped. */
+    bool isMapped() const { return address != nullptr; }
+
+    /** Return the contents of the mapped file. */
+    const char *data() const { return address; }
+
+    /** Return the size of the mapped file. */
+    size_t size() const { return length; }
+};
+
+#endif /* ASMASE_MAPPED_FILE_H */
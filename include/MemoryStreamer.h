@@ -26,19 +26,21 @@
 #include <cstdio>
 #include <cstring>
 
-#include <sys/ptrace.h>
-#include <sys/types.h>
+#include <unistd.h>
 
-/** Class for reading memory from a tracee element by element. */
-class MemoryStreamer {
-    /** PID of the tracee. */
-    pid_t pid;
+#include "Tracee.h"
 
-    /** Last word read by ptrace. */
-    long _buffer;
+/**
+ * Class for reading memory from a tracee element by element. Memory is read
+ * in bulk up to the end of the current page so that we don't need a system
+ * call per element (or any system calls at all in the data arena).
+ */
+class MemoryStreamer {
+    /** The tracee to read from. */
+    Tracee &tracee;
 
-    /** Pointer to last word read by ptrace. */
-    unsigned char *buffer;
+    /** Buffered memory from the tracee. */
+    bytestring buffer;
 
     /** Next address at which to read. */
     unsigned char *address;
@@ -46,15 +48,37 @@ class MemoryStreamer {
     /** Offset in the buffer of remaining unread data. */
     size_t offset;
 
+    /**
+     * Refill the buffer starting at the given address.
+     * @return Zero on success, nonzero on failure.
+     */
+    int refill(unsigned char *start)
+    {
+        // Never cross a page boundary so that a read can't fail just because
+        // the following page isn't mapped
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t amount = pageSize - reinterpret_cast<uintptr_t>(start) % pageSize;
+
+        buffer.resize(amount);
+        offset = 0;
+        if (tracee.readMemory(start, &buffer[0], amount)) {
+            buffer.clear();
+            printf("\ncannot access memory at address %p\n",
+                   static_cast<void *>(start));
+            return 1;
+        }
+
+        return 0;
+    }
+
 public:
     /**
-     * Create a memory streamer for the given process starting at the given
+     * Create a memory streamer for the given tracee starting at the given
      * address.
      */
-    MemoryStreamer(pid_t pid, void *address)
-        : pid{pid},
-          buffer{reinterpret_cast<unsigned char *>(&_buffer)},
-          address{static_cast<unsigned char *>(address)}, offset{0} {}
+    MemoryStreamer(Tracee &tracee, void *address)
+        : tracee(tracee), address{static_cast<unsigned char *>(address)},
+          offset{0} {}
 
     /** Get the next address to be read from. */
     void *getAddress() const { return static_cast<void *>(address); }
@@ -69,21 +93,14 @@ public:
         auto outBuffer = reinterpret_cast<unsigned char *>(&out);
         size_t outOffset = 0;
         while (outOffset < sizeof(T)) {
-            if (offset % sizeof(long) == 0) {
-                errno = 0;
-                _buffer = ptrace(PTRACE_PEEKDATA, pid, address + outOffset,
-                                 nullptr);
-                if (errno) {
-                    printf("\ncannot access memory at address %p\n",
-                           static_cast<void *>(address + outOffset));
+            if (offset >= buffer.size()) {
+                if (refill(address + outOffset))
                     return 1;
-                }
-
-                offset = 0;
             }
 
-            size_t amount = std::min(sizeof(T) - outOffset, sizeof(long) - offset);
-            memcpy(outBuffer + outOffset, buffer + offset, amount);
+            size_t amount = std::min(sizeof(T) - outOffset,
+                                     buffer.size() - offset);
+            memcpy(outBuffer + outOffset, &buffer[offset], amount);
 
             offset += amount;
             outOffset += amount;
@@ -0,0 +1,63 @@
+/*
+ * PerfCounters class.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_PERF_COUNTERS_H
+#define ASMASE_PERF_COUNTERS_H
+
+#include <cstdint>
+
+#include <sys/types.h>
+
+/**
+ * Hardware performance counters (cycles and retired instructions) attached to
+ * a process with perf_event_open(). Only user-space execution is counted, and
+ * the counters only run while the process is running, so the difference
+ * between two reads around a run of code is the cost of that code.
+ */
+class PerfCounters {
+    /** File descriptors for the cycle and instruction counters. */
+    int cyclesFd, instructionsFd;
+
+public:
+    PerfCounters() : cyclesFd{-1}, instructionsFd{-1} {}
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    /**
+     * Attach the counters to a process. This fails if the kernel or hardware
+     * don't support them or if perf_event_paranoid doesn't allow it.
+     * @return Zero on success, nonzero on failure.
+     */
+    int open(pid_t pid);
+
+    /** Return whether the counters were opened successfully. */
+    bool isOpen() const { return cyclesFd != -1; }
+
+    /**
+     * Read the current counts.
+     * @return Zero on success, nonzero on failure.
+     */
+    int read(uint64_t &cycles, uint64_t &instructions) const;
+};
+
+#endif /* ASMASE_PERF_COUNTERS_H */
@@ -0,0 +1,44 @@
+/*
+ * Pool of worker processes which run many scripts concurrently.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_POOL_H
+#define ASMASE_POOL_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Run scripts concurrently on a pool of worker processes, each of which has its
+ * own assembler and tracees and serves requests like the daemon does (see
+ * runDaemonWorker()). A directory stands for the regular files in it, in
+ * order by name. Scripts are handed out one at a time to whichever worker is
+ * idle, so a long script doesn't hold up the ones queued behind it. Each
+ * script's output is collected separately and written out in the order the
+ * scripts were given as soon as the scripts before it have finished, so the
+ * output is the same as running them one after another.
+ * @param jobs The maximum number of workers, or zero for one per online CPU.
+ * @return The exit status: zero if every script succeeded, nonzero otherwise.
+ */
+int runScripts(const std::vector<std::string> &paths, unsigned int jobs,
+               const std::string &cpu, const std::string &features,
+               bool jsonOutput);
+
+#endif /* ASMASE_POOL_H */
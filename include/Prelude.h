@@ -0,0 +1,135 @@
+/*
+ * Directives which are replayed before each assembly.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_PRELUDE_H
+#define ASMASE_PRELUDE_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Definitions made by earlier assembly which later assembly should see. Each
+ * line is assembled from scratch, so directives which define things for later
+ * (macros and symbol assignments) are collected here and replayed before the
+ * line. Since the definitions are replayed in order, later definitions
+ * override earlier ones like they do in a single file.
+ */
+class Prelude {
+    /** Definitions added by one call to add(). */
+    class Entry {
+    public:
+        std::string source;
+
+        /**
+         * If the entry was collapsed to a constant assignment (see
+         * collapseLast()), the symbol it assigns. Otherwise, empty.
+         */
+        std::string symbol;
+    };
+
+    /** The target's comment and statement separator strings. */
+    std::string commentString, separatorString;
+
+    std::vector<Entry> entries;
+
+    /** The collected definitions, i.e., the entries' source concatenated. */
+    std::string source;
+
+    /** Number of lines in the source. */
+    int lineCount;
+
+    /**
+     * Hash of the definitions as they were added. Collapsing entries doesn't
+     * change their meaning, so it doesn't change the hash.
+     */
+    uint64_t hash;
+
+    /** See getLastAssigned(). */
+    std::vector<std::string> lastAssigned;
+
+    /** Split source into trimmed statements, dropping comments. */
+    std::vector<std::string> splitStatements(const std::string &source) const;
+
+    /** Rebuild the source and line count from the entries. */
+    void rebuildSource();
+
+public:
+    Prelude(const std::string &commentString,
+            const std::string &separatorString);
+
+    /**
+     * Add the definitions from source which assembled successfully. Other
+     * statements are ignored. Definitions inside of a conditional or repeated
+     * block (.if, .rept, .irp, or .irpc) are only made when the block is run,
+     * so such a block is added as a whole, minus any statements in it which
+     * don't define anything.
+     * @return Whether there were any definitions.
+     */
+    bool add(const std::string &source);
+
+    /**
+     * Get the symbols assigned by the definitions added by the last call to
+     * add(). This is empty if the definitions do anything besides assigning
+     * symbols by name (e.g., define a macro), in which case they can't be
+     * collapsed.
+     */
+    const std::vector<std::string> &getLastAssigned() const
+    {
+        return lastAssigned;
+    }
+
+    /**
+     * Replace the definitions added by the last call to add() with constant
+     * assignments of the values the symbols they assigned ended up with. A
+     * symbol which wasn't assigned after all (e.g., because it was in a false
+     * conditional) is left out. An earlier constant assignment of the same
+     * symbol is dropped unless a definition after it refers to the symbol.
+     * This keeps a symbol which is assigned over and over (e.g., a counter)
+     * from making the definitions longer every time.
+     * @param constants The symbols from getLastAssigned() which were assigned
+     * constants and their values.
+     */
+    void collapseLast(
+        const std::vector<std::pair<std::string, int64_t>> &constants);
+
+    /** Forget all definitions. */
+    void clear();
+
+    /** Get the definitions, which end with a newline if not empty. */
+    const std::string &getSource() const { return source; }
+
+    int getLineCount() const { return lineCount; }
+
+    /** Get a hash identifying the definitions. */
+    uint64_t getHash() const { return hash; }
+
+    /**
+     * Return how many more directives which start a multi-line construct
+     * (.macro, .rept, .irp, .irpc, and conditionals) than directives which end
+     * one the source contains. If this is positive, the source needs more
+     * lines before it can be assembled.
+     */
+    int getNesting(const std::string &source) const;
+};
+
+#endif /* ASMASE_PRELUDE_H */
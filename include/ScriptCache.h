@@ -0,0 +1,95 @@
+/*
+ * ScriptCache class.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_SCRIPT_CACHE_H
+#define ASMASE_SCRIPT_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "Support.h"
+
+/**
+ * Pre-assembled machine code for the lines of a script, which can be saved to
+ * and loaded from disk. Lines are looked up by line number, and each entry
+ * also records a hash of the line's text and of the definitions (see Prelude)
+ * it was assembled with so that a stale entry is never used.
+ */
+class ScriptCache {
+    class Entry {
+    public:
+        uint64_t textHash;
+        bytestring machineCode;
+    };
+
+    /** Cached lines, keyed by line number. */
+    std::unordered_map<int, Entry> entries;
+
+public:
+    /** Initial value for hash(). */
+    static const uint64_t HASH_SEED = UINT64_C(0xcbf29ce484222325);
+
+    /** Hash a buffer (FNV-1a), optionally continuing a previous hash. */
+    static uint64_t hash(const void *buffer, size_t size,
+                         uint64_t seed = HASH_SEED);
+
+    static uint64_t hash(const std::string &str, uint64_t seed = HASH_SEED)
+    {
+        return hash(str.data(), str.size(), seed);
+    }
+
+    /**
+     * Get the path of the on-disk cache for a script. Caches live in
+     * $XDG_CACHE_HOME/asmase (or ~/.cache/asmase).
+     * @return An empty string on failure.
+     */
+    static std::string getCachePath(const std::string &filename);
+
+    /**
+     * Add the machine code for a line which was assembled with the
+     * definitions with the given hash.
+     */
+    void add(int lineno, const std::string &text, uint64_t preludeHash,
+             const bytestring &machineCode);
+
+    /**
+     * Look up the machine code for a line.
+     * @return nullptr if the line isn't cached.
+     */
+    const bytestring *lookup(int lineno, const std::string &text,
+                             uint64_t preludeHash) const;
+
+    /**
+     * Load a cache from disk. The cache is only loaded if it was saved with
+     * the same key.
+     * @return Zero on success, nonzero on failure (including a stale cache).
+     */
+    int load(const std::string &path, uint64_t key);
+
+    /**
+     * Save the cache to disk along with the given key.
+     * @return Zero on success, nonzero on failure.
+     */
+    int save(const std::string &path, uint64_t key) const;
+};
+
+#endif /* ASMASE_SCRIPT_CACHE_H */
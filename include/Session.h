@@ -0,0 +1,62 @@
+/*
+ * Running a session of input.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASMASE_SESSION_H
+#define ASMASE_SESSION_H
+
+#include <cstdio>
+#include <memory>
+#include <string>
+
+class Assembler;
+class Inputter;
+class JsonWriter;
+class SpareTracees;
+class Tracee;
+
+/**
+ * Create the inputter for a session: a script file if scriptFile is given,
+ * otherwise lines given on the command line if commands is given (which must
+ * outlive the inputter), otherwise piped stdin, or interactive stdin.
+ * @return nullptr on error.
+ */
+Inputter *createInputter(const std::string &scriptFile, std::string &commands);
+
+/**
+ * Read input until it ends or the user quits, running each line: built-ins are
+ * run, and assembly is assembled and run in the tracee. When the user resets
+ * the tracee, it is replaced with one of the spares.
+ * @param json If not nullptr, a JSON record is written for every line which is
+ * run (see --output=json).
+ * @return The exit status: for batch input, 1 if any line failed and 0
+ * otherwise; always 0 for interactive input.
+ */
+int runSession(Inputter &inputter, std::shared_ptr<Tracee> tracee,
+               SpareTracees &spares, Assembler &assembler, JsonWriter *json);
+
+/**
+ * Set up JSON output. The JSON records get the current stdout to themselves,
+ * and everything that is printed for humans is sent to stderr instead.
+ * @return The stream for the records, or nullptr on error.
+ */
+FILE *openJsonOutput();
+
+#endif /* ASMASE_SESSION_H */
@@ -32,4 +32,11 @@
 
 typedef std::basic_string<unsigned char> bytestring;
 
+/** Contents of a section other than the text section and where it goes. */
+class DataSection {
+public:
+    uint64_t address;
+    bytestring contents;
+};
+
 #endif /* ASMASE_SUPPORT_H */
@@ -22,11 +22,14 @@
 #ifndef ASMASE_TRACEE_H
 #define ASMASE_TRACEE_H
 
+#include <map>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include <sys/types.h>
 
+#include "PerfCounters.h"
 #include "Support.h"
 
 enum class RegisterCategory;
@@ -42,6 +45,78 @@ class RegisterValue;
  */
 class UserRegisters;
 
+/** Code run by Tracee::executeCode() and what it cost. */
+class CodeRun {
+public:
+    /** How a run ended. */
+    enum class Stop {
+        /** The run finished normally. */
+        TRAP,
+        /** The tracee was stopped by another signal. */
+        SIGNAL,
+        /** The tracee exited. */
+        EXITED,
+        /** The tracee was killed by a signal. */
+        TERMINATED,
+        /** The tracee couldn't be run or waited for. */
+        ERROR,
+    };
+
+    /** Address the code was run at. */
+    uint64_t address;
+
+    /** The machine code (without the trap). */
+    bytestring machineCode;
+
+    /** Whether the performance counters were available for the run. */
+    bool measured;
+
+    /** Cycles and instructions spent in user space during the run. */
+    uint64_t cycles, instructions;
+
+    /** How the run ended. */
+    Stop stop;
+
+    /**
+     * The signal which stopped or killed the tracee, or its exit status,
+     * depending on stop.
+     */
+    int stopStatus;
+
+    /** Wall-clock time the run took, in nanoseconds. */
+    uint64_t nanoseconds;
+
+    CodeRun()
+        : address{0}, measured{false}, cycles{0}, instructions{0},
+          stop{Stop::ERROR}, stopStatus{0}, nanoseconds{0} {}
+};
+
+/** Options for how tracee processes are created (see Tracee::configure()). */
+class TraceeConfig {
+public:
+    /**
+     * Address to map the code at, with the data arena right after it, or zero
+     * to let the kernel choose. A tracee created while another one is using
+     * the address (e.g., a spare) goes in the next free slot after it.
+     */
+    uint64_t address;
+
+    /**
+     * Whether to disable address space randomization in the tracee. This only
+     * applies when the tracee stub is exec'd.
+     */
+    bool noRandomize;
+
+    /**
+     * Whether to exec the tracee stub (asmase-tracee, next to the asmase
+     * executable) instead of forking asmase itself. The tracee is forked
+     * anyway if the stub can't be found or fails.
+     */
+    bool useStub;
+
+    TraceeConfig() : address{0}, noRandomize{false}, useStub{true} {}
+};
+
 /**
  * Class encapsulating a tracee process. This process is used to execute
  * instructions given by the user.
@@ -53,7 +128,8 @@ class Tracee {
 
     /** Create the tracee for the host platform. */
     static Tracee *createPlatformTracee(pid_t pid, void *sharedMemory,
-                                        size_t sharedSize);
+                                        size_t sharedSize, void *arena,
+                                        size_t arenaSize);
 
 protected:
     // Architecture-dependent information
@@ -69,24 +145,111 @@ protected:
     /** PID of the tracee process. */
     pid_t pid;
 
-    /** Start of memory shared with the tracee. */
+    /** Whether the tracee process has exited and been reaped. */
+    bool exited;
+
+    /**
+     * Start of memory shared with the tracee. Code is appended to the start of
+     * this region so that earlier code stays at a fixed address, data for the
+     * code is stacked downwards from the end of the region, and the last page
+     * is scratch space for executeInstruction().
+     */
     void *sharedMemory;
 
     /** Size of memory shared with the tracee. */
     size_t sharedSize;
 
+    /** Offset in the shared memory where the next code will be placed. */
+    size_t codeOffset;
+
+    /** Size of the data placed with placeData(). */
+    size_t dataSize;
+
+    /**
+     * Start of the data arena shared with the tracee. This is mapped at the
+     * same address in both processes, so we can access it directly.
+     */
+    void *arena;
+
+    /** Size of the data arena. */
+    size_t arenaSize;
+
+    /** Memory allocated from the arena, keyed by address. */
+    std::map<void *, size_t> arenaAllocations;
+
+    /** Memory mapped in the tracee by mapMemory(), keyed by address. */
+    std::map<void *, size_t> mappings;
+
+    /**
+     * Counters for measuring code run by executeCode(). These are opened the
+     * first time they're needed.
+     */
+    PerfCounters counters;
+
+    /** Whether opening the counters has been attempted. */
+    bool countersOpened;
+
+    /** The last code run by executeCode(). */
+    CodeRun lastRun;
+
+    /**
+     * Kill the tracee process and unmap the memory shared with it. This is
+     * called by the destructor.
+     */
+    void release();
+
+    /** Return whether the given range lies entirely within the arena. */
+    bool inArena(const void *address, size_t size) const;
+
+    /**
+     * Run the tracee starting at the given address until it traps. If run is
+     * given, how the tracee stopped is recorded in it.
+     * @return Zero on success, positive on error, negative on fatal error.
+     */
+    int runUntilTrap(void *pc, CodeRun *run = nullptr);
+
     /**
      * Get the instruction to use to trigger a software trap (i.e., a
      * breakpoint).
      */
     virtual const bytestring &getTrapInstruction() = 0;
 
+    /** Get the instruction to use to make a system call. */
+    virtual const bytestring &getSyscallInstruction() = 0;
+
     /**
      * Set the program counter of the tracee to the given location.
      * @return Zero on success, nonzero on failure.
      */
     virtual int setProgramCounter(void *pc) = 0;
 
+    /**
+     * Save the tracee's registers so that they can be restored after they are
+     * clobbered by an injected system call.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int saveRegisters() = 0;
+
+    /**
+     * Restore the registers saved by saveRegisters().
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int restoreRegisters() = 0;
+
+    /**
+     * Set up the registers for a system call with the given number and
+     * arguments. Missing arguments are zero.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int setSyscallRegisters(long number,
+                                    const std::vector<long> &args) = 0;
+
+    /**
+     * Get the return value of the system call that the tracee just made.
+     * @return Zero on success, nonzero on failure.
+     */
+    virtual int getSyscallResult(long &result) = 0;
+
     /**
      * Update the register values stored in the registers pointer.
      * @return Zero on success, nonzero on failure.
@@ -103,20 +266,127 @@ protected:
 
 public:
     Tracee(const RegisterInfo &regInfo, UserRegisters *registers,
-           pid_t pid, void *sharedMemory, size_t sharedSize);
+           pid_t pid, void *sharedMemory, size_t sharedSize,
+           void *arena, size_t arenaSize);
     virtual ~Tracee();
 
     pid_t getPid() const { return pid; }
 
     /**
-     * Execute the given instruction on the tracee.
+     * Execute the given instruction on the tracee in scratch memory. This
+     * doesn't affect the code that has been run with executeCode().
      * @return Zero on success, positive on error, negative on fatal error.
      */
     int executeInstruction(const bytestring &machineCode);
 
+    /**
+     * Get the address where the next code passed to executeCode() will be
+     * placed.
+     */
+    void *getCodeAddress() const
+    {
+        return static_cast<unsigned char *>(sharedMemory) + codeOffset;
+    }
+
+    /**
+     * Append the given machine code to the code that has already been run and
+     * execute it. The code stays in place afterwards, so later code can jump
+     * back into it.
+     * @return Zero on success, positive on error, negative on fatal error.
+     */
+    int executeCode(const bytestring &machineCode);
+
+    /**
+     * Get the last code run with executeCode(), including the cycles and
+     * instructions it took if performance counters are available.
+     */
+    const CodeRun &getLastRun() const { return lastRun; }
+
+    /** Get the address that the next data passed to placeData() must end at. */
+    void *getDataEnd() const;
+
+    /**
+     * Copy the sections for code into the shared memory. They must have been
+     * placed below getDataEnd(), highest address first. Like code, the data
+     * stays in place.
+     * @return Zero on success, positive on error.
+     */
+    int placeData(const std::vector<DataSection> &sections);
+
     /** Pretty-print machine code. */
     virtual void printInstruction(const bytestring &machineCode);
 
+    /**
+     * Read the tracee's memory into a buffer. Nothing is printed on failure
+     * since callers may be probing how far they can read.
+     * @return Zero on success, nonzero on failure.
+     */
+    int readMemory(const void *address, void *buffer, size_t size);
+
+    /**
+     * Write a buffer into the tracee's memory.
+     * @return Zero on success, nonzero on failure.
+     */
+    int writeMemory(void *address, const void *buffer, size_t size);
+
+    /**
+     * Allocate page-aligned memory from the data arena. This doesn't involve
+     * the tracee at all, so it is the cheapest way to get a buffer.
+     * @return nullptr if there isn't enough room left in the arena.
+     */
+    void *allocateArena(size_t size);
+
+    /**
+     * Free memory allocated by allocateArena().
+     * @return Zero on success, nonzero if the address wasn't allocated.
+     */
+    int freeArena(void *address);
+
+    /** Get the memory allocated from the arena, keyed by address. */
+    const std::map<void *, size_t> &getArenaAllocations() const
+    {
+        return arenaAllocations;
+    }
+
+    /**
+     * Make the tracee execute a system call without disturbing its registers.
+     * The result is the raw return value of the system call, i.e., -errno on
+     * failure.
+     * @return Zero on success, positive on error, negative on fatal error.
+     */
+    int injectSyscall(long number, const std::vector<long> &args,
+                      long &result);
+
+    /**
+     * Map memory in the tracee with mmap. The mapping is tracked so that it
+     * can be unmapped by address later.
+     * @return Zero on success, positive on error, negative on fatal error.
+     */
+    int mapMemory(size_t size, int prot, int flags, int fd, off_t offset,
+                  void *&addressOut);
+
+    /**
+     * Unmap memory mapped by mapMemory().
+     * @return Zero on success, positive on error, negative on fatal error.
+     */
+    int unmapMemory(void *address);
+
+    /** Get the memory mapped by mapMemory(), keyed by address. */
+    const std::map<void *, size_t> &getMappings() const { return mappings; }
+
+    /**
+     * Open a file in the tracee. The path is resolved relative to the
+     * tracee's working directory.
+     * @return Zero on success, positive on error, negative on fatal error.
+     */
+    int openFile(const std::string &path, int flags, int &fdOut);
+
+    /**
+     * Close a file descriptor in the tracee.
+     * @return Zero on success, positive on error, negative on fatal error.
+     */
+    int closeFile(int fd);
+
     /**
      * Print the registers in the given categories (which may be a bitwise OR
      * of multiple categories).
@@ -131,10 +401,55 @@ public:
     std::shared_ptr<RegisterValue> getRegisterValue(const std::string &regName);
 
     /**
-     * Create a tracee process.
+     * Get the current values of all of the registers in the given categories
+     * (which may be a bitwise OR of multiple categories).
+     * @return Zero on success, nonzero on failure.
+     */
+    int getRegisterValues(
+        RegisterCategory categories,
+        std::vector<std::pair<const RegisterDesc *,
+                              std::shared_ptr<RegisterValue>>> &valuesOut);
+
+    /**
+     * Set the options for tracees created from now on. This should be called
+     * before any tracees are created.
+     */
+    static void configure(const TraceeConfig &config);
+
+    /**
+     * Create a tracee process: the tracee stub if it's available, otherwise a
+     * fork of this process.
      * @return nullptr on error.
      */
     static std::shared_ptr<Tracee> createTracee();
 };
 
+/**
+ * Tracees which are forked ahead of time, so that a fresh tracee can be swapped
+ * in without waiting for one to be forked and to start up. Spares should be
+ * forked early, while the process is still small (in particular, before LLVM
+ * is set up), and from the thread which will trace them.
+ */
+class SpareTracees {
+    std::vector<std::shared_ptr<Tracee>> spares;
+
+    /** Number of spares to keep. */
+    size_t count;
+
+public:
+    explicit SpareTracees(size_t count) : count{count} {}
+
+    /** Get the number of spares which are ready. */
+    size_t size() const { return spares.size(); }
+
+    /** Fork tracees until there are enough spares. */
+    void fill();
+
+    /**
+     * Take a spare tracee, or create one if there are none left.
+     * @return nullptr on error.
+     */
+    std::shared_ptr<Tracee> take();
+};
+
 #endif /* ASMASE_TRACEE_H */
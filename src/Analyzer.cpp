@@ -0,0 +1,575 @@
+/*
+ * Static analysis of code with the scheduling model of the target.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+
+#include <llvm/Config/llvm-config.h>
+
+#include "Analyzer.h"
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+
+#include <algorithm>
+#include <cinttypes>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <llvm/MC/MCInst.h>
+#include <llvm/MC/MCInstrDesc.h>
+#include <llvm/MC/MCInstrInfo.h>
+#include <llvm/MC/MCRegisterInfo.h>
+#include <llvm/MC/MCSchedule.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+using namespace llvm;
+
+#include "AssemblerContext.h"
+#include "Disassembler.h"
+#include "Tracee.h"
+
+/**
+ * Number of iterations simulated to find the steady-state throughput. The
+ * first half is treated as warmup.
+ */
+static const unsigned int STEADY_STATE_ITERATIONS = 100;
+
+/** Number of iterations used to find loop-carried dependency chains. */
+static const unsigned int CHAIN_ITERATIONS = 16;
+
+/** Maximum number of cycles shown in the timeline. */
+static const unsigned int TIMELINE_MAX_CYCLES = 80;
+
+/** What the scheduling model says about an instruction. */
+class InstructionInfo {
+public:
+    /** The instruction as text. */
+    std::string text;
+
+    /**
+     * Whether the scheduling class of the instruction is known. Variant
+     * classes depend on the operands and can't be resolved at the MC layer.
+     */
+    bool known;
+
+    /** Cycles until the results of the instruction are available. */
+    unsigned int latency;
+
+    /** Number of micro-ops the instruction is split into. */
+    unsigned int microOps;
+
+    /** Processor resources used, as (resource index, cycles) pairs. */
+    std::vector<std::pair<unsigned int, unsigned int>> resources;
+
+    /** Registers written and read by the instruction. */
+    std::vector<unsigned int> defs, uses;
+
+    InstructionInfo() : known{false}, latency{1}, microOps{1} {}
+};
+
+/** When an instruction ran in a simulation. */
+class ScheduledInstruction {
+public:
+    unsigned int dispatch, issue, complete;
+
+    /**
+     * Index of the instruction whose result this instruction waited for
+     * longest, or -1 if it didn't wait for another instruction.
+     */
+    int pred;
+};
+
+/**
+ * Reservation table for the units of the processor resources in a
+ * simulation, one bit per cycle.
+ */
+class ResourceTable {
+    std::vector<std::vector<std::vector<bool>>> busy;
+
+    bool isFree(const std::vector<bool> &unit, unsigned int start,
+                unsigned int cycles) const
+    {
+        for (unsigned int i = start; i < start + cycles; ++i) {
+            if (i < unit.size() && unit[i])
+                return false;
+        }
+        return true;
+    }
+
+public:
+    ResourceTable(const MCSchedModel &model)
+        : busy(model.getNumProcResourceKinds())
+    {
+        for (unsigned int i = 1; i < busy.size(); ++i)
+            busy[i].resize(std::max(model.getProcResource(i)->NumUnits, 1U));
+    }
+
+    /**
+     * Find a unit of a resource which is free for the given cycles.
+     * @return The index of the unit, or -1 if they are all busy.
+     */
+    int findUnit(unsigned int resource, unsigned int start,
+                 unsigned int cycles) const
+    {
+        for (size_t i = 0; i < busy[resource].size(); ++i) {
+            if (isFree(busy[resource][i], start, cycles))
+                return i;
+        }
+        return -1;
+    }
+
+    void reserve(unsigned int resource, int unit, unsigned int start,
+                 unsigned int cycles)
+    {
+        std::vector<bool> &table = busy[resource][unit];
+        if (table.size() < start + cycles)
+            table.resize(start + cycles);
+        for (unsigned int i = start; i < start + cycles; ++i)
+            table[i] = true;
+    }
+};
+
+/** Look up an instruction in the scheduling model. */
+static void getInstructionInfo(const MCSubtargetInfo &subtargetInfo,
+                               const MCInstrInfo &instrInfo,
+                               const MCInst &inst, InstructionInfo &info)
+{
+    const MCInstrDesc &desc = instrInfo.get(inst.getOpcode());
+    const MCSchedModel &model = subtargetInfo.getSchedModel();
+
+    if (model.hasInstrSchedModel()) {
+        const MCSchedClassDesc *schedClass =
+            model.getSchedClassDesc(desc.getSchedClass());
+        if (schedClass->isValid() && !schedClass->isVariant()) {
+            info.known = true;
+            info.microOps = schedClass->NumMicroOps;
+
+            // Use the slowest result for all of them
+            int latency = 0;
+            for (unsigned int i = 0; i < schedClass->NumWriteLatencyEntries;
+                 ++i) {
+                const MCWriteLatencyEntry *entry =
+                    subtargetInfo.getWriteLatencyEntry(schedClass, i);
+                latency = std::max(latency, static_cast<int>(entry->Cycles));
+            }
+            info.latency = std::max(latency, 1);
+
+            for (const MCWriteProcResEntry *entry =
+                     subtargetInfo.getWriteProcResBegin(schedClass);
+                 entry != subtargetInfo.getWriteProcResEnd(schedClass);
+                 ++entry) {
+                if (entry->Cycles)
+                    info.resources.emplace_back(entry->ProcResourceIdx,
+                                                entry->Cycles);
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < inst.getNumOperands(); ++i) {
+        const MCOperand &operand = inst.getOperand(i);
+        if (!operand.isReg() || !operand.getReg())
+            continue;
+        if (i < desc.getNumDefs())
+            info.defs.push_back(operand.getReg());
+        else
+            info.uses.push_back(operand.getReg());
+    }
+    for (unsigned int i = 0; i < desc.getNumImplicitDefs(); ++i)
+        info.defs.push_back(desc.getImplicitDefs()[i]);
+    for (unsigned int i = 0; i < desc.getNumImplicitUses(); ++i)
+        info.uses.push_back(desc.getImplicitUses()[i]);
+}
+
+/**
+ * Simulate running the instructions as a loop body. If withResources is
+ * false, only the register dependencies are considered, i.e., the machine is
+ * infinitely wide.
+ */
+static void simulate(const std::vector<InstructionInfo> &infos,
+                     const MCSchedModel &model,
+                     const MCRegisterInfo &registerInfo,
+                     unsigned int iterations, bool withResources,
+                     std::vector<ScheduledInstruction> &scheduleOut)
+{
+    ResourceTable resources{model};
+    std::unordered_map<unsigned int, int> lastWriter;
+    unsigned int issueWidth = std::max(model.IssueWidth, 1U);
+    unsigned int microOps = 0;
+
+    scheduleOut.resize(iterations * infos.size());
+    for (size_t k = 0; k < scheduleOut.size(); ++k) {
+        const InstructionInfo &info = infos[k % infos.size()];
+        ScheduledInstruction &scheduled = scheduleOut[k];
+
+        scheduled.dispatch = withResources ? microOps / issueWidth : 0;
+        microOps += info.microOps;
+
+        unsigned int ready = scheduled.dispatch + 1;
+        scheduled.pred = -1;
+        for (unsigned int reg : info.uses) {
+            auto it = lastWriter.find(reg);
+            if (it != lastWriter.end() &&
+                scheduleOut[it->second].complete >= ready) {
+                ready = scheduleOut[it->second].complete;
+                scheduled.pred = it->second;
+            }
+        }
+
+        // Find the first cycle where all of the resources are available
+        scheduled.issue = ready;
+        while (withResources) {
+            bool available = true;
+            for (auto &resource : info.resources) {
+                if (resources.findUnit(resource.first, scheduled.issue,
+                                       resource.second) < 0) {
+                    available = false;
+                    break;
+                }
+            }
+            if (available)
+                break;
+            ++scheduled.issue;
+        }
+        if (withResources) {
+            for (auto &resource : info.resources) {
+                int unit = resources.findUnit(resource.first, scheduled.issue,
+                                              resource.second);
+                if (unit >= 0)
+                    resources.reserve(resource.first, unit, scheduled.issue,
+                                      resource.second);
+            }
+        }
+        scheduled.complete = scheduled.issue + info.latency;
+
+        for (unsigned int reg : info.defs) {
+            for (MCRegAliasIterator alias{reg, &registerInfo, true};
+                 alias.isValid(); ++alias)
+                lastWriter[*alias] = k;
+        }
+    }
+}
+
+/** Get the cycle when the last instruction of an iteration completes. */
+static unsigned int getIterationEnd(
+    const std::vector<ScheduledInstruction> &schedule, size_t count,
+    unsigned int iteration)
+{
+    unsigned int end = 0;
+    for (size_t i = 0; i < count; ++i)
+        end = std::max(end, schedule[iteration * count + i].complete);
+    return end;
+}
+
+/**
+ * Follow the dependencies back from the instruction which completes last in
+ * the given iteration.
+ * @return The chain, first instruction first, as indices into the schedule.
+ */
+static std::vector<int> getCriticalChain(
+    const std::vector<ScheduledInstruction> &schedule, size_t count,
+    unsigned int iteration)
+{
+    int last = iteration * count;
+    for (size_t i = 0; i < count; ++i) {
+        if (schedule[iteration * count + i].complete >
+            schedule[last].complete)
+            last = iteration * count + i;
+    }
+
+    std::vector<int> chain;
+    for (int k = last; k >= 0; k = schedule[k].pred)
+        chain.push_back(k);
+    std::reverse(chain.begin(), chain.end());
+    return chain;
+}
+
+/** Print the resource usage of an instruction. */
+static void printResources(const MCSchedModel &model,
+                           const InstructionInfo &info)
+{
+    for (auto &resource : info.resources) {
+        printf(" %s", model.getProcResource(resource.first)->Name);
+        if (resource.second > 1)
+            printf("x%u", resource.second);
+    }
+}
+
+/**
+ * Get the reciprocal throughput of a set of instructions if nothing else
+ * limits them, i.e., the number of cycles that the most contended resource or
+ * dispatch is busy. The total cycles for each resource are also returned.
+ */
+static double getReciprocalThroughput(
+    const MCSchedModel &model, const std::vector<InstructionInfo> &infos,
+    std::vector<unsigned int> &cyclesOut, std::string &bottleneckOut)
+{
+    unsigned int microOps = 0;
+    cyclesOut.assign(model.getNumProcResourceKinds(), 0);
+    for (const InstructionInfo &info : infos) {
+        microOps += info.microOps;
+        for (auto &resource : info.resources)
+            cyclesOut[resource.first] += resource.second;
+    }
+
+    double rthroughput =
+        static_cast<double>(microOps) / std::max(model.IssueWidth, 1U);
+    bottleneckOut = "dispatch";
+    for (unsigned int i = 1; i < cyclesOut.size(); ++i) {
+        const MCProcResourceDesc *desc = model.getProcResource(i);
+        double pressure = static_cast<double>(cyclesOut[i]) /
+                          std::max(desc->NumUnits, 1U);
+        if (pressure > rthroughput) {
+            rthroughput = pressure;
+            bottleneckOut = desc->Name;
+        }
+    }
+    return rthroughput;
+}
+
+/** Print a timeline of a simulation like llvm-mca does. */
+static void printTimeline(const std::vector<InstructionInfo> &infos,
+                          const std::vector<ScheduledInstruction> &schedule,
+                          unsigned int iterations)
+{
+    size_t count = infos.size();
+    unsigned int width = std::min(getIterationEnd(schedule, count,
+                                                  iterations - 1),
+                                  TIMELINE_MAX_CYCLES);
+
+    printf("%-10s", "Index");
+    for (unsigned int cycle = 0; cycle < width; ++cycle)
+        printf("%u", cycle % 10);
+    printf("\n");
+
+    for (unsigned int iteration = 0; iteration < iterations; ++iteration) {
+        for (size_t i = 0; i < count; ++i) {
+            const ScheduledInstruction &scheduled =
+                schedule[iteration * count + i];
+            char label[32];
+            snprintf(label, sizeof(label), "[%u,%zu]", iteration, i);
+            printf("%-10s", label);
+
+            for (unsigned int cycle = 0; cycle < width; ++cycle) {
+                char c;
+                if (cycle == scheduled.dispatch)
+                    c = 'D';
+                else if (cycle > scheduled.dispatch &&
+                         cycle < scheduled.issue)
+                    c = '=';
+                else if (cycle + 1 == scheduled.complete)
+                    c = 'E';
+                else if (cycle >= scheduled.issue &&
+                         cycle < scheduled.complete)
+                    c = 'e';
+                else if (cycle < scheduled.complete)
+                    c = '.';
+                else
+                    c = ' ';
+                putchar(c);
+            }
+            printf("  %s\n", infos[i].text.c_str());
+        }
+    }
+
+    if (getIterationEnd(schedule, count, iterations - 1) > width)
+        printf("(truncated to %u cycles)\n", width);
+}
+
+/** Print a dependency chain. */
+static void printChain(const std::vector<InstructionInfo> &infos,
+                       const std::vector<int> &chain, size_t count)
+{
+    for (int k : chain) {
+        printf("  [%zu,%zu] %s\n", k / count, k % count,
+               infos[k % count].text.c_str());
+    }
+}
+
+/* See Analyzer.h. */
+int analyzeCode(const AssemblerContext &context, const CodeRun &run,
+                unsigned int iterations)
+{
+    Disassembler disassembler{context};
+    const MCSubtargetInfo &subtargetInfo = disassembler.getSubtargetInfo();
+    const MCSchedModel &model = subtargetInfo.getSchedModel();
+
+    std::vector<DisassembledInstruction> instructions;
+    disassembler.disassemble(run.machineCode, run.address, instructions);
+
+    std::vector<InstructionInfo> infos(instructions.size());
+    bool allKnown = true;
+    for (size_t i = 0; i < instructions.size(); ++i) {
+        if (instructions[i].valid) {
+            infos[i].text = disassembler.printInstruction(instructions[i].inst);
+            getInstructionInfo(subtargetInfo, *context.instrInfo,
+                               instructions[i].inst, infos[i]);
+        } else
+            infos[i].text = "<invalid>";
+        if (!infos[i].known)
+            allKnown = false;
+    }
+    if (infos.empty()) {
+        fprintf(stderr, "no instructions to analyze\n");
+        return 1;
+    }
+
+    if (!model.hasInstrSchedModel()) {
+        printf("note: the scheduling model for %s has no instruction "
+               "information; assuming a latency of 1\n", context.cpu.c_str());
+    } else if (!allKnown) {
+        printf("note: instructions marked with ? have no fixed scheduling "
+               "class; assuming a latency of 1\n");
+    }
+
+    // Per-instruction information
+    std::vector<unsigned int> resourceCycles;
+    std::string bottleneck;
+    size_t count = infos.size();
+    unsigned int microOps = 0;
+    printf("Index   Lat  Uops  RThru  Instruction\n");
+    for (size_t i = 0; i < count; ++i) {
+        const InstructionInfo &info = infos[i];
+        double rthroughput =
+            getReciprocalThroughput(model, {info}, resourceCycles, bottleneck);
+        char label[32];
+        snprintf(label, sizeof(label), "[%zu]", i);
+        microOps += info.microOps;
+        printf("%-6s%c %-4u %-5u %-6.2f %s\n", label, info.known ? ' ' : '?',
+               info.latency, info.microOps, rthroughput, info.text.c_str());
+    }
+    printf("\n");
+
+    printf("Resources per instruction:\n");
+    for (size_t i = 0; i < count; ++i) {
+        printf("  [%zu]", i);
+        printResources(model, infos[i]);
+        printf("\n");
+    }
+    printf("\n");
+
+    double rthroughput =
+        getReciprocalThroughput(model, infos, resourceCycles, bottleneck);
+
+    // Latency-bound chains, ignoring resources
+    std::vector<ScheduledInstruction> chainSchedule;
+    simulate(infos, model, *context.registerInfo, CHAIN_ITERATIONS, false,
+             chainSchedule);
+    std::vector<int> chain = getCriticalChain(chainSchedule, count, 0);
+    unsigned int half = CHAIN_ITERATIONS / 2;
+    double carriedLatency =
+        static_cast<double>(
+            getIterationEnd(chainSchedule, count, CHAIN_ITERATIONS - 1) -
+            getIterationEnd(chainSchedule, count, half - 1)) /
+        (CHAIN_ITERATIONS - half);
+
+    // Everything together
+    unsigned int steadyIterations =
+        std::max(iterations, STEADY_STATE_ITERATIONS);
+    std::vector<ScheduledInstruction> schedule;
+    simulate(infos, model, *context.registerInfo, steadyIterations, true,
+             schedule);
+    half = steadyIterations / 2;
+    double simulatedCycles =
+        static_cast<double>(
+            getIterationEnd(schedule, count, steadyIterations - 1) -
+            getIterationEnd(schedule, count, half - 1)) /
+        (steadyIterations - half);
+
+    printf("Instructions:          %zu\n", count);
+    printf("Micro-ops:             %u\n", microOps);
+    printf("Dispatch width:        %u\n", model.IssueWidth);
+    printf("Block RThroughput:     %.2f (bound by %s)\n", rthroughput,
+           bottleneck.c_str());
+    printf("Loop-carried latency:  %.2f\n", carriedLatency);
+    printf("Predicted cycles/iter: %.2f (IPC %.2f)\n", simulatedCycles,
+           simulatedCycles > 0 ? count / simulatedCycles : 0.0);
+    printf("\n");
+
+    printf("Resource pressure per iteration:\n");
+    for (unsigned int i = 1; i < resourceCycles.size(); ++i) {
+        if (!resourceCycles[i])
+            continue;
+        const MCProcResourceDesc *desc = model.getProcResource(i);
+        printf("  %-16s %5.2f  (%u cycles on %u units)\n", desc->Name,
+               static_cast<double>(resourceCycles[i]) /
+                   std::max(desc->NumUnits, 1U),
+               resourceCycles[i], desc->NumUnits);
+    }
+    printf("\n");
+
+    unsigned int chainLatency = getIterationEnd(chainSchedule, count, 0);
+    printf("Critical chain within an iteration (%u cycles):\n", chainLatency);
+    printChain(infos, chain, count);
+
+    // A loop-carried chain shows up as an instruction which depends on
+    // itself from an earlier iteration
+    std::vector<int> carriedChain =
+        getCriticalChain(chainSchedule, count, CHAIN_ITERATIONS - 1);
+    std::unordered_map<size_t, size_t> positions;
+    for (size_t i = carriedChain.size(); i-- > 0;) {
+        auto it = positions.find(carriedChain[i] % count);
+        if (it != positions.end()) {
+            printf("Loop-carried chain (%.2f cycles/iteration):\n",
+                   carriedLatency);
+            printChain(infos,
+                       std::vector<int>{carriedChain.begin() + i + 1,
+                                        carriedChain.begin() + it->second + 1},
+                       count);
+            break;
+        }
+        positions[carriedChain[i] % count] = i;
+    }
+    printf("\n");
+
+    printTimeline(infos, schedule, iterations);
+    printf("\n");
+
+    printf("Measured:\n");
+    if (!run.measured) {
+        printf("  performance counters are not available\n");
+        return 0;
+    }
+    double measuredIterations = static_cast<double>(run.instructions) / count;
+    printf("  cycles:       %" PRIu64 "\n", run.cycles);
+    printf("  instructions: %" PRIu64 "\n", run.instructions);
+    if (run.cycles) {
+        printf("  IPC:          %.2f\n",
+               static_cast<double>(run.instructions) / run.cycles);
+    }
+    if (measuredIterations >= 1) {
+        printf("  iterations:   %.1f (estimated)\n", measuredIterations);
+        printf("  cycles/iter:  %.2f\n", run.cycles / measuredIterations);
+    }
+
+    return 0;
+}
+
+#else
+
+/* See Analyzer.h. */
+int analyzeCode(const AssemblerContext &context, const CodeRun &run,
+                unsigned int iterations)
+{
+    fprintf(stderr, "analysis requires LLVM 3.7 or newer\n");
+    return 1;
+}
+
+#endif
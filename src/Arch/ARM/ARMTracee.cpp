@@ -31,15 +31,23 @@
 
 extern const RegisterInfo ARMRegisters;
 static const bytestring ARMTrapInstruction = {0xf0, 0x01, 0xf0, 0xe7};
+static const bytestring ARMSyscallInstruction = {0x00, 0x00, 0x00, 0xef}; // svc 0
 
-ARMTracee::ARMTracee(pid_t pid, void *sharedMemory, size_t sharedSize)
-    : Tracee{ARMRegisters, new UserRegisters, pid, sharedMemory, sharedSize} {}
+ARMTracee::ARMTracee(pid_t pid, void *sharedMemory, size_t sharedSize,
+                     void *arena, size_t arenaSize)
+    : Tracee{ARMRegisters, new UserRegisters, pid, sharedMemory, sharedSize,
+             arena, arenaSize} {}
 
 const bytestring &ARMTracee::getTrapInstruction()
 {
     return ARMTrapInstruction;
 }
 
+const bytestring &ARMTracee::getSyscallInstruction()
+{
+    return ARMSyscallInstruction;
+}
+
 int ARMTracee::setProgramCounter(void *pc)
 {
     struct user_regs regs;
@@ -80,6 +88,60 @@ int ARMTracee::updateRegisters()
     return 0;
 }
 
+int ARMTracee::saveRegisters()
+{
+    if (ptrace(PTRACE_GETREGS, pid, nullptr, &savedRegisters) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not save registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int ARMTracee::restoreRegisters()
+{
+    if (ptrace(PTRACE_SETREGS, pid, nullptr, &savedRegisters) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not restore registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int ARMTracee::setSyscallRegisters(long number, const std::vector<long> &args)
+{
+    struct user_regs regs = savedRegisters;
+
+    // EABI: arguments in r0-r5 and the system call number in r7
+    for (int i = 0; i < 6; ++i)
+        regs.uregs[i] = (i < (int) args.size()) ? args[i] : 0;
+    regs.uregs[7] = number;
+
+    if (ptrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set system call registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int ARMTracee::getSyscallResult(long &result)
+{
+    struct user_regs regs;
+
+    if (ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get system call result\n");
+        return 1;
+    }
+
+    result = regs.uregs[0];
+    return 0;
+}
+
 void ARMTracee::printInstruction(const bytestring &machineCode)
 {
     if (machineCode.size() % 4) {
@@ -100,9 +162,10 @@ void ARMTracee::printInstruction(const bytestring &machineCode)
 
 /* See Tracee.h. */
 Tracee *Tracee::createPlatformTracee(pid_t pid, void *sharedMemory,
-                                     size_t sharedSize)
+                                     size_t sharedSize, void *arena,
+                                     size_t arenaSize)
 {
-    return new ARMTracee{pid, sharedMemory, sharedSize};
+    return new ARMTracee{pid, sharedMemory, sharedSize, arena, arenaSize};
 }
 
 #include "Tracee.inc"
@@ -19,6 +19,7 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 
@@ -31,15 +32,27 @@
 
 extern const RegisterInfo X86Registers;
 static const bytestring X86TrapInstruction = {0xcc};
+#ifdef __x86_64__
+static const bytestring X86SyscallInstruction = {0x0f, 0x05}; // syscall
+#else
+static const bytestring X86SyscallInstruction = {0xcd, 0x80}; // int $0x80
+#endif
 
-X86Tracee::X86Tracee(pid_t pid, void *sharedMemory, size_t sharedSize)
-    : Tracee{X86Registers, new UserRegisters, pid, sharedMemory, sharedSize} {}
+X86Tracee::X86Tracee(pid_t pid, void *sharedMemory, size_t sharedSize,
+                     void *arena, size_t arenaSize)
+    : Tracee{X86Registers, new UserRegisters, pid, sharedMemory, sharedSize,
+             arena, arenaSize} {}
 
 const bytestring &X86Tracee::getTrapInstruction()
 {
     return X86TrapInstruction;
 }
 
+const bytestring &X86Tracee::getSyscallInstruction()
+{
+    return X86SyscallInstruction;
+}
+
 int X86Tracee::setProgramCounter(void *pc)
 {
     struct user_regs_struct regs;
@@ -65,6 +78,81 @@ int X86Tracee::setProgramCounter(void *pc)
     return 0;
 }
 
+int X86Tracee::saveRegisters()
+{
+    if (ptrace(PTRACE_GETREGS, pid, nullptr, &savedRegisters) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not save registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int X86Tracee::restoreRegisters()
+{
+    if (ptrace(PTRACE_SETREGS, pid, nullptr, &savedRegisters) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not restore registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int X86Tracee::setSyscallRegisters(long number, const std::vector<long> &args)
+{
+    struct user_regs_struct regs = savedRegisters;
+    long arg[6] = {};
+
+    std::copy(args.begin(), args.end(), arg);
+
+#ifdef __x86_64__
+    regs.rax = number;
+    regs.rdi = arg[0];
+    regs.rsi = arg[1];
+    regs.rdx = arg[2];
+    regs.r10 = arg[3];
+    regs.r8  = arg[4];
+    regs.r9  = arg[5];
+#else
+    regs.eax = number;
+    regs.ebx = arg[0];
+    regs.ecx = arg[1];
+    regs.edx = arg[2];
+    regs.esi = arg[3];
+    regs.edi = arg[4];
+    regs.ebp = arg[5];
+#endif
+
+    if (ptrace(PTRACE_SETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not set system call registers\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int X86Tracee::getSyscallResult(long &result)
+{
+    struct user_regs_struct regs;
+
+    if (ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+        perror("ptrace");
+        fprintf(stderr, "could not get system call result\n");
+        return 1;
+    }
+
+#ifdef __x86_64__
+    result = regs.rax;
+#else
+    result = regs.eax;
+#endif
+
+    return 0;
+}
+
 template <typename T>
 inline void copyRegister(T *dest, void *src)
 {
@@ -196,9 +284,10 @@ void X86Tracee::reconstructTagWord()
 
 /* See Tracee.h. */
 Tracee *Tracee::createPlatformTracee(pid_t pid, void *sharedMemory,
-                                     size_t sharedSize)
+                                     size_t sharedSize, void *arena,
+                                     size_t arenaSize)
 {
-    return new X86Tracee{pid, sharedMemory, sharedSize};
+    return new X86Tracee{pid, sharedMemory, sharedSize, arena, arenaSize};
 }
 
 #include "Tracee.inc"
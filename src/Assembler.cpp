@@ -20,14 +20,18 @@
  */
 
 #include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/MC/MCAsmBackend.h>
 #include <llvm/MC/MCAsmInfo.h>
 #include <llvm/MC/MCContext.h>
+#include <llvm/MC/MCExpr.h>
 #include <llvm/MC/MCInstrInfo.h>
 #include <llvm/MC/MCObjectFileInfo.h>
 #include <llvm/MC/MCRegisterInfo.h>
 #include <llvm/MC/MCStreamer.h>
 #include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/MCSymbol.h>
+#include <llvm/MC/SubtargetFeature.h>
 #if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 9)
 #include <llvm/MC/MCParser/MCTargetAsmParser.h>
 #else
@@ -53,135 +57,322 @@ using namespace llvm;
 using std::error_code;
 using std::error_category;
 using std::system_category;
-#define OwningPtr std::unique_ptr
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include <unistd.h>
+
 #include "Assembler.h"
+#include "AssemblerContext.h"
+#include "Builtins.h"
+#include "CaptureStreamer.h"
 #include "Inputter.h"
+#include "MappedFile.h"
+#include "ScriptCache.h"
 
 /** The reserved size of the output SmallString. */
 static const int OUTPUT_BUFFER_SIZE = 4096;
 
+/** The number of lines of a script that a thread assembles at a time. */
+static const size_t SCRIPT_CHUNK_SIZE = 64;
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+/** The MC context and streamer can be reset and reused. */
+#define HAVE_MC_RESET
+
+/**
+ * The number of instructions to assemble with a pipeline before it is rebuilt.
+ * This bounds how much memory anything which resetting doesn't free (e.g., the
+ * MC context's allocators) can use.
+ */
+static const unsigned int PIPELINE_MAX_USES = 1024;
+#else
+/* Older versions of LLVM can't reset the MC layer, so start over every time. */
+static const unsigned int PIPELINE_MAX_USES = 1;
+#endif
+
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR < 7
 /** Return the text section (i.e., machine code) for an object file. */
 static error_code getTextSection(object::ObjectFile &objFile,
                                  StringRef &result);
+#endif
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+/**
+ * Collapse the definitions which were just added to the prelude to the
+ * constants they assigned (see Prelude::collapseLast()), which are looked up
+ * in the MC context that assembled them. Nothing is collapsed unless every
+ * symbol they assigned is a constant.
+ */
+static void collapsePrelude(Prelude &prelude, MCContext &mcCtx);
+#endif
+
+/**
+ * Where the source being assembled came from, for diagnostics. Line numbers in
+ * the source are relative to lineno.
+ */
+class DiagContext {
+public:
+    const Inputter &inputter;
+    int lineno;
+
+    DiagContext(const Inputter &inputter, int lineno)
+        : inputter(inputter), lineno{lineno} {}
+};
 
 /**
  * Diagnostic callback. We need this because we read input line by line so we
  * keep track of diagnostic information (filename and line number) on our own.
- * @param arg Pointer to the Inputter instance being used.
+ * @param arg Pointer to the DiagContext for the source being assembled, or
+ * nullptr to discard diagnostics.
  */
 static void asmaseDiagHandler(const SMDiagnostic &diag, void *arg);
 
-/** Context storing LLVM state that can be reused. */
-class AssemblerContext {
-    static bool llvmIsInit;
-
-public:
-    std::string tripleName;
-    Triple triple;
-    std::string cpu;
-    const Target *target;
-    OwningPtr<MCRegisterInfo> registerInfo;
-    OwningPtr<MCAsmInfo> asmInfo;
-    OwningPtr<MCInstrInfo> instrInfo;
-
-    AssemblerContext()
-        : tripleName{sys::getDefaultTargetTriple()},
-          triple{tripleName}
-    {
-        if (!llvmIsInit) {
-            llvm::InitializeNativeTarget();
-            llvm::InitializeNativeTargetAsmParser();
-            llvmIsInit = true;
-        }
+/* See AssemblerContext.h. */
+AssemblerContext::AssemblerContext(const std::string &cpu,
+                                   const std::string &features)
+    : tripleName{sys::getDefaultTargetTriple()},
+      triple{tripleName}, cpu{cpu}, features{features}
+{
+    if (!llvmIsInit) {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmParser();
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+        llvm::InitializeNativeTargetDisassembler();
+#endif
+        llvmIsInit = true;
+    }
 
-        std::string err;
-        target = TargetRegistry::lookupTarget(tripleName, err);
-        assert(target && "Could not get target!");
+    std::string err;
+    target = TargetRegistry::lookupTarget(tripleName, err);
+    assert(target && "Could not get target!");
 
-        registerInfo.reset(target->createMCRegInfo(tripleName));
-        assert(registerInfo && "Unable to create target register info!");
+    registerInfo.reset(target->createMCRegInfo(tripleName));
+    assert(registerInfo && "Unable to create target register info!");
 
 #if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 4)
-        asmInfo.reset(target->createMCAsmInfo(*registerInfo, tripleName));
+    asmInfo.reset(target->createMCAsmInfo(*registerInfo, tripleName));
 #else
-        asmInfo.reset(target->createMCAsmInfo(tripleName));
+    asmInfo.reset(target->createMCAsmInfo(tripleName));
 #endif
-        assert(asmInfo && "Unable to create target asm info!");
+    assert(asmInfo && "Unable to create target asm info!");
 
-        instrInfo.reset(target->createMCInstrInfo());
-        assert(instrInfo && "Unable to create target instruction info!");
-    }
-};
+    instrInfo.reset(target->createMCInstrInfo());
+    assert(instrInfo && "Unable to create target instruction info!");
+}
+
+/* See AssemblerContext.h. */
+MCSubtargetInfo *AssemblerContext::createSubtargetInfo() const
+{
+    return target->createMCSubtargetInfo(tripleName, cpu, features);
+}
 
 bool AssemblerContext::llvmIsInit = false;
 
+/**
+ * Get the features of the host CPU as a sorted, comma-separated list of
+ * +feature and -feature, or an empty string if they can't be detected.
+ */
+static std::string getHostFeatures()
+{
+    StringMap<bool> hostFeatures;
+    if (!sys::getHostCPUFeatures(hostFeatures))
+        return {};
+
+    std::vector<std::string> sorted;
+    for (auto &feature : hostFeatures)
+        sorted.push_back((feature.getValue() ? "+" : "-") +
+                         feature.getKey().str());
+    std::sort(sorted.begin(), sorted.end());
+
+    SubtargetFeatures features;
+    for (const std::string &feature : sorted)
+        features.AddFeature(feature);
+    return features.getString();
+}
+
 /* See Assembler.h. */
-std::shared_ptr<AssemblerContext> Assembler::createAssemblerContext()
+std::shared_ptr<AssemblerContext>
+Assembler::createAssemblerContext(const std::string &cpu,
+                                  const std::string &features)
 {
-    return std::shared_ptr<AssemblerContext>{new AssemblerContext};
+    // The host's features only make sense for the host's CPU
+    std::string contextCPU = cpu;
+    std::string contextFeatures;
+    if (contextCPU.empty()) {
+        contextCPU = sys::getHostCPUName();
+        contextFeatures = getHostFeatures();
+    }
+
+    // Later features override earlier ones
+    if (!features.empty()) {
+        if (!contextFeatures.empty())
+            contextFeatures += ',';
+        contextFeatures += features;
+    }
+
+    return std::shared_ptr<AssemblerContext>{
+        new AssemblerContext{contextCPU, contextFeatures}};
 }
 
 /* See Assembler.h. */
-int Assembler::assembleInstruction(const std::string &instruction,
-                                   bytestring &machineCodeOut,
-                                   const Inputter &inputter)
+std::shared_future<std::shared_ptr<AssemblerContext>>
+Assembler::createAssemblerContextAsync(const std::string &cpu,
+                                       const std::string &features)
 {
-    const Triple &triple = context->triple;
-    const std::string &tripleName = context->tripleName;
-    const std::string &mcpu = context->cpu;
-    const Target *target = context->target;
-    const MCRegisterInfo *registerInfo = context->registerInfo.get();
-    const MCAsmInfo *asmInfo = context->asmInfo.get();
-    const MCInstrInfo *instrInfo = context->instrInfo.get();
+    return std::async(std::launch::async, createAssemblerContext, cpu,
+                      features).share();
+}
 
-    // Set up the input
+/* See Assembler.h. */
+void Assembler::waitForContext()
+{
+    if (context)
+        return;
+
+    context = contextFuture.get();
+
+    // Nothing can have been defined yet, so the prelude can start over with
+    // the target's syntax
+    prelude = Prelude{context->asmInfo->getCommentString(),
+                      context->asmInfo->getSeparatorString()};
+}
+
+/* See Assembler.h. */
+const std::string &Assembler::getTriple()
+{
+    waitForContext();
+    return context->tripleName;
+}
+
+/* See Assembler.h. */
+const std::string &Assembler::getCPU()
+{
+    waitForContext();
+    return context->cpu;
+}
+
+/* See Assembler.h. */
+const std::string &Assembler::getFeatures()
+{
+    waitForContext();
+    return context->features;
+}
+
+/* See Assembler.h. */
+const AssemblerContext &Assembler::getContext()
+{
+    waitForContext();
+    return *context;
+}
+
+/** MC layer state which is reused between instructions. */
+class AssemblerPipeline {
+public:
+    /**
+     * Source being assembled. The source manager's buffer refers to it
+     * instead of copying it.
+     */
+    std::string currentSource;
+
+    /**
+     * Source manager for the input, whose only buffer is currentSource. The
+     * parser starts at the first buffer and macro and .rept expansions return
+     * to the buffer they started in, so the source manager is replaced rather
+     * than given another buffer for every instruction.
+     */
     SourceMgr srcMgr;
-    srcMgr.AddNewSourceBuffer(
-        MemoryBuffer::getMemBufferCopy(instruction, "assembly"), SMLoc{});
-    srcMgr.setDiagHandler(
-        asmaseDiagHandler, const_cast<void *>(static_cast<const void *>(&inputter)));
 
-    // Set up the output
     SmallString<OUTPUT_BUFFER_SIZE> outputString;
-    raw_svector_ostream outputStream{outputString};
+    raw_svector_ostream outputStream;
+
+    OwningPtr<MCObjectFileInfo> objectFileInfo;
+    OwningPtr<MCContext> mcCtx;
+    OwningPtr<MCSubtargetInfo> subtargetInfo;
+    OwningPtr<MCStreamer> streamer;
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+    /** Symbol state shared with the capture streamer. */
+    CaptureState state;
+#endif
+
+    /** Number of instructions assembled with this pipeline. */
+    unsigned int uses;
+
+    AssemblerPipeline(const AssemblerContext &context);
+
+#ifdef HAVE_MC_RESET
+    /** Reset the pipeline so that it can assemble another instruction. */
+    void reset(const AssemblerContext &context);
+#endif
+
+    /**
+     * Assemble source to machine code which will be placed at the given
+     * address (see Assembler::assembleInstruction()). Diagnostics are printed
+     * with diagContext, or discarded if it is nullptr. On LLVM 3.7 and newer,
+     * the symbols defined by the source are left in state.definedSymbols.
+     * @param source Source to assemble, which the pipeline takes over.
+     * @param labels Labels defined by earlier code, or nullptr.
+     * @return Zero on success, nonzero on failure.
+     */
+    int assemble(const AssemblerContext &context, std::string source,
+                 uint64_t address, uint64_t dataEnd,
+                 const std::unordered_map<std::string, uint64_t> *labels,
+                 const DiagContext *diagContext, bytestring &machineCodeOut,
+                 std::vector<DataSection> &sectionsOut, bool &cacheableOut);
+
+private:
+    /**
+     * (Re)initialize the object file info. This has to be done whenever the
+     * MC context is reset because the sections it creates are owned by the
+     * context.
+     */
+    void initObjectFileInfo(const AssemblerContext &context);
+};
+
+AssemblerPipeline::AssemblerPipeline(const AssemblerContext &context)
+    : outputStream{outputString}, uses{0}
+{
+    const std::string &tripleName = context.tripleName;
+    const std::string &mcpu = context.cpu;
+    const Target *target = context.target;
+    const MCRegisterInfo *registerInfo = context.registerInfo.get();
+    const MCAsmInfo *asmInfo = context.asmInfo.get();
+    const MCInstrInfo *instrInfo = context.instrInfo.get();
 
     // Set up the context
-    OwningPtr<MCObjectFileInfo> objectFileInfo{new MCObjectFileInfo()};
+    objectFileInfo.reset(new MCObjectFileInfo());
 #if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 4)
-    MCContext mcCtx{asmInfo, registerInfo, objectFileInfo.get(), &srcMgr};
+    mcCtx.reset(new MCContext{asmInfo, registerInfo, objectFileInfo.get(),
+                              &srcMgr});
 #else
-    MCContext mcCtx{*asmInfo, *registerInfo, objectFileInfo.get(), &srcMgr};
-#endif
-#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 9)
-    objectFileInfo->InitMCObjectFileInfo(triple, true, CodeModel::Default,
-                                         mcCtx);
-#elif LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7
-    objectFileInfo->InitMCObjectFileInfo(triple, Reloc::Default,
-                                         CodeModel::Default, mcCtx);
-#else
-    objectFileInfo->InitMCObjectFileInfo(tripleName, Reloc::Default,
-                                         CodeModel::Default, mcCtx);
+    mcCtx.reset(new MCContext{*asmInfo, *registerInfo, objectFileInfo.get(),
+                              &srcMgr});
 #endif
+    initObjectFileInfo(context);
 
     // Set up the streamer
-    OwningPtr<MCSubtargetInfo> subtargetInfo;
-    std::string features;
-    subtargetInfo.reset(
-        target->createMCSubtargetInfo(tripleName, mcpu, features));
+    subtargetInfo.reset(context.createSubtargetInfo());
     assert(subtargetInfo && "Unable to create subtarget info!");
 
 #if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
     MCCodeEmitter *codeEmitter =
-        target->createMCCodeEmitter(*instrInfo, *registerInfo, mcCtx);
+        target->createMCCodeEmitter(*instrInfo, *registerInfo, *mcCtx);
 #elif LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 2
     MCCodeEmitter *codeEmitter =
         target->createMCCodeEmitter(*instrInfo, *registerInfo, *subtargetInfo,
-                                    mcCtx);
+                                    *mcCtx);
 #else
     MCCodeEmitter *codeEmitter =
-        target->createMCCodeEmitter(*instrInfo, *subtargetInfo, mcCtx);
+        target->createMCCodeEmitter(*instrInfo, *subtargetInfo, *mcCtx);
 #endif
 #if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 4)
     MCAsmBackend *MAB =
@@ -192,21 +383,677 @@ int Assembler::assembleInstruction(const std::string &instruction,
     MCAsmBackend *MAB = target->createMCAsmBackend(tripleName);
 #endif
 
-#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 6)
-    OwningPtr<MCStreamer> streamer{
-        createELFStreamer(mcCtx, *MAB, outputStream, codeEmitter, true)};
+    // The streamer takes ownership of the code emitter and backend
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+    streamer.reset(
+        createCaptureStreamer(*mcCtx, MAB, outputStream, codeEmitter,
+                              asmInfo->isLittleEndian(), state));
+#elif LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 6
+    streamer.reset(
+        createELFStreamer(*mcCtx, *MAB, outputStream, codeEmitter, true));
 #elif LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 4
-    OwningPtr<MCStreamer> streamer{
-        createELFStreamer(mcCtx, nullptr, *MAB, outputStream, codeEmitter,
-                          true, false)};
+    streamer.reset(
+        createELFStreamer(*mcCtx, nullptr, *MAB, outputStream, codeEmitter,
+                          true, false));
 #else
-    OwningPtr<MCStreamer> streamer{
-        createELFStreamer(mcCtx, *MAB, outputStream, codeEmitter, true, false)};
+    streamer.reset(
+        createELFStreamer(*mcCtx, *MAB, outputStream, codeEmitter, true, false));
 #endif
+}
+
+/* See above. */
+void AssemblerPipeline::initObjectFileInfo(const AssemblerContext &context)
+{
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 9)
+    objectFileInfo->InitMCObjectFileInfo(context.triple, true,
+                                         CodeModel::Default, *mcCtx);
+#elif LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7
+    objectFileInfo->InitMCObjectFileInfo(context.triple, Reloc::Default,
+                                         CodeModel::Default, *mcCtx);
+#else
+    objectFileInfo->InitMCObjectFileInfo(context.tripleName, Reloc::Default,
+                                         CodeModel::Default, *mcCtx);
+#endif
+}
+
+#ifdef HAVE_MC_RESET
+/* See above. */
+void AssemblerPipeline::reset(const AssemblerContext &context)
+{
+    // The streamer refers to sections owned by the context, so it goes first
+    streamer->reset();
+    mcCtx->reset();
+    initObjectFileInfo(context);
+
+    // The MC context refers to the source manager, so the new one has to be
+    // at the same address
+    srcMgr.~SourceMgr();
+    new (&srcMgr) SourceMgr;
+
+    outputString.clear();
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR < 8
+    outputStream.resync();
+#endif
+}
+#endif
+
+/**
+ * Get a pipeline which is ready to assemble another instruction, creating or
+ * resetting it as necessary.
+ */
+static AssemblerPipeline &
+preparePipeline(std::unique_ptr<AssemblerPipeline> &pipeline,
+                const AssemblerContext &context)
+{
+    if (!pipeline || pipeline->uses >= PIPELINE_MAX_USES)
+        pipeline.reset(new AssemblerPipeline{context});
+#ifdef HAVE_MC_RESET
+    else if (pipeline->uses > 0)
+        pipeline->reset(context);
+#endif
+    ++pipeline->uses;
+    return *pipeline;
+}
+
+Assembler::Assembler(
+    std::shared_future<std::shared_ptr<AssemblerContext>> context)
+    : contextFuture{std::move(context)}, cacheHits{0}, cacheMisses{0},
+      prelude{"", ""},
+      blockOpen{false}, blockReady{false}, blockImplicit{false},
+      blockNesting{0}, blockLineno{0} {}
+
+/** See Assembler.h. */
+class Assembler::PendingScript {
+public:
+    std::vector<ScriptLine> lines;
+
+    /** Index into lines by line number, including duplicate lines. */
+    std::unordered_map<int, size_t> lineIndex;
+
+    /** Each line is assembled with a prefix of this prelude source. */
+    std::string preludeSource;
+
+    /** Where to save the script's cache once it's done, and its key. */
+    std::string cachePath;
+    uint64_t key;
+
+    /** Protects the results in lines and linesDone. */
+    std::mutex mutex;
+
+    /** Signaled whenever a line is done. */
+    std::condition_variable lineDone;
+
+    size_t linesDone;
+
+    /** Next line to hand out to a worker. */
+    std::atomic<size_t> nextChunk;
+
+    std::vector<std::thread> workers;
+
+    PendingScript() : key{0}, linesDone{0}, nextChunk{0} {}
+
+    ~PendingScript()
+    {
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+};
+
+Assembler::~Assembler()
+{
+    // Save whatever is still being pre-assembled
+    while (!pendingScripts.empty()) {
+        std::string filename = pendingScripts.begin()->first;
+        finishScript(filename);
+    }
+}
+
+/**
+ * Normalize an instruction for use as a cache key by trimming leading and
+ * trailing whitespace and collapsing other runs of whitespace into a single
+ * space. Whitespace in string and character literals is left alone.
+ */
+static std::string normalizeInstruction(const std::string &instruction)
+{
+    std::string normalized;
+    normalized.reserve(instruction.size());
+
+    bool pendingSpace = false;
+    for (size_t i = 0; i < instruction.size(); ++i) {
+        char c = instruction[i];
+
+        if (isspace(c)) {
+            pendingSpace = !normalized.empty();
+            continue;
+        }
+
+        if (pendingSpace) {
+            normalized += ' ';
+            pendingSpace = false;
+        }
+
+        normalized += c;
+        if (c == '"') {
+            // Copy the rest of the string literal verbatim
+            while (++i < instruction.size()) {
+                normalized += instruction[i];
+                if (instruction[i] == '\\' && i + 1 < instruction.size())
+                    normalized += instruction[++i];
+                else if (instruction[i] == '"')
+                    break;
+            }
+        } else if (c == '\'' && i + 1 < instruction.size()) {
+            // Character literal
+            normalized += instruction[++i];
+            if (instruction[i] == '\\' && i + 1 < instruction.size())
+                normalized += instruction[++i];
+        }
+    }
+
+    return normalized;
+}
+
+/* See Assembler.h. */
+std::string Assembler::getCacheKey(const std::string &instruction,
+                                   uint64_t preludeHash) const
+{
+    std::string key = normalizeInstruction(instruction);
+    key += '\0';
+    key += context->cpu;
+    key += '\0';
+    key += context->features;
+    key += '\0';
+    key += std::to_string(preludeHash);
+    return key;
+}
+
+/* See Assembler.h. */
+void Assembler::clearCache()
+{
+    cache.clear();
+    cacheIndex.clear();
+    cacheHits = cacheMisses = 0;
+}
+
+/* See Assembler.h. */
+uint64_t Assembler::getTargetHash() const
+{
+    std::string target = ASMASE_VERSION;
+    target += '\0';
+    target += std::to_string(LLVM_VERSION_MAJOR);
+    target += '.';
+    target += std::to_string(LLVM_VERSION_MINOR);
+    target += '\0';
+    target += context->tripleName;
+    target += '\0';
+    target += context->cpu;
+    target += '\0';
+    target += context->features;
+    return ScriptCache::hash(target);
+}
+
+/* See Assembler.h. */
+int Assembler::loadScript(const std::string &filename)
+{
+    waitForContext();
+    finishScript(filename);
+
+    FILE *file = fopen(filename.c_str(), "r");
+    if (!file)
+        return 1;
+
+    // Scripts are read straight out of a mapping when possible; only other
+    // kinds of files are copied into a buffer
+    MappedFile mapping;
+    std::string buffer;
+    if (mapping.map(fileno(file))) {
+        char chunk[4096];
+        size_t size;
+        while ((size = fread(chunk, 1, sizeof(chunk), file)) > 0)
+            buffer.append(chunk, size);
+    }
+    bool readError = ferror(file);
+    fclose(file);
+    if (readError)
+        return 1;
+    StringRef source = mapping.isMapped()
+                           ? StringRef{mapping.data(), mapping.size()}
+                           : StringRef{buffer};
+
+    // The cache is only valid for exactly this source and target
+    uint64_t key =
+        ScriptCache::hash(source.data(), source.size(), getTargetHash());
+    std::string cachePath = ScriptCache::getCachePath(filename);
+
+    ScriptCache &script = scripts[filename];
+    script = ScriptCache{};
+    if (!cachePath.empty() && !script.load(cachePath, key))
+        return 0;
+
+    // Definitions made by the script are tracked as we go so that each line
+    // is assembled with the same prelude as when the script is run. The
+    // prelude only grows, so each line's prelude is a prefix of the final
+    // one. If a definition turns out to fail when the script is run, the
+    // prelude hashes won't match and the lines after it are assembled again.
+    Prelude scriptPrelude = prelude;
+    std::vector<ScriptLine> lines;
+    std::unordered_map<std::string, size_t> firstLines;
+    std::vector<std::pair<int, size_t>> duplicateLines;
+    std::string block;
+    int blockNesting = 0;
+
+    size_t start = 0;
+    int lineno = 0;
+    while (start < source.size()) {
+        size_t end = source.find('\n', start);
+        if (end == StringRef::npos)
+            end = source.size();
+        std::string line = source.substr(start, end - start).str();
+        start = end + 1;
+        ++lineno;
+
+        if (isBuiltin(line))
+            continue;
+
+        // Multi-line constructs are assembled as a block when the script is
+        // run, so they are only needed for their definitions
+        if (blockNesting > 0 || scriptPrelude.getNesting(line) > 0) {
+            block += line;
+            block += '\n';
+            blockNesting += scriptPrelude.getNesting(line);
+            if (blockNesting <= 0) {
+                scriptPrelude.add(block);
+                block.clear();
+            }
+            continue;
+        }
+
+        // Lines which make definitions are never cached
+        uint64_t preludeHash = scriptPrelude.getHash();
+        if (scriptPrelude.add(line))
+            continue;
+
+        std::string cacheKey = getCacheKey(line, preludeHash);
+        auto cached = cacheIndex.find(cacheKey);
+        if (cached != cacheIndex.end()) {
+            script.add(lineno, line, preludeHash, cached->second->second);
+            continue;
+        }
+
+        auto first = firstLines.find(cacheKey);
+        if (first != firstLines.end()) {
+            duplicateLines.emplace_back(lineno, first->second);
+            continue;
+        }
+
+        firstLines.emplace(std::move(cacheKey), lines.size());
+        lines.emplace_back(lineno, std::move(line), preludeHash,
+                           scriptPrelude.getSource().size());
+    }
+
+    if (lines.empty()) {
+        if (!cachePath.empty())
+            script.save(cachePath, key);
+        return 0;
+    }
+
+    std::unique_ptr<PendingScript> pending{new PendingScript};
+    for (size_t i = 0; i < lines.size(); ++i)
+        pending->lineIndex[lines[i].lineno] = i;
+    for (auto &duplicate : duplicateLines)
+        pending->lineIndex[duplicate.first] = duplicate.second;
+    pending->lines = std::move(lines);
+    pending->preludeSource = scriptPrelude.getSource();
+    pending->cachePath = std::move(cachePath);
+    pending->key = key;
+
+    startScriptWorkers(*pending);
+    pendingScripts[filename] = std::move(pending);
+    return 0;
+}
+
+/**
+ * Return how many threads to use to assemble the given number of lines of a
+ * script.
+ */
+static unsigned int getWorkerCount(size_t numLines)
+{
+    unsigned int workers = std::thread::hardware_concurrency();
+    size_t chunks = (numLines + SCRIPT_CHUNK_SIZE - 1) / SCRIPT_CHUNK_SIZE;
+    if (workers > chunks)
+        workers = chunks;
+    return workers ? workers : 1;
+}
+
+/* See Assembler.h. */
+void Assembler::startScriptWorkers(PendingScript &pending)
+{
+    // Each thread claims chunks of lines and assembles them with its own
+    // pipeline. The assembler context is only read, so it's shared.
+    std::shared_ptr<AssemblerContext> sharedContext = context;
+    PendingScript *script = &pending;
+    auto worker = [sharedContext, script]() {
+        std::vector<ScriptLine> &lines = script->lines;
+        std::unique_ptr<AssemblerPipeline> workerPipeline;
+        for (;;) {
+            size_t start = script->nextChunk.fetch_add(SCRIPT_CHUNK_SIZE);
+            if (start >= lines.size())
+                break;
+            size_t end = std::min(start + SCRIPT_CHUNK_SIZE, lines.size());
+
+            for (size_t i = start; i < end; ++i) {
+                ScriptLine &line = lines[i];
+                AssemblerPipeline &current =
+                    preparePipeline(workerPipeline, *sharedContext);
+
+                // Lines which depend on their address (e.g., because they use
+                // labels) are never cached, so the address doesn't matter
+                bytestring machineCode;
+                std::vector<DataSection> sections;
+                bool cacheable;
+                int error = current.assemble(
+                    *sharedContext,
+                    script->preludeSource.substr(0, line.preludeSize) +
+                        line.text,
+                    0, 0, nullptr, nullptr, machineCode, sections, cacheable);
+
+                {
+                    std::lock_guard<std::mutex> lock{script->mutex};
+                    line.machineCode = std::move(machineCode);
+                    line.assembled = !error && cacheable;
+                    line.done = true;
+                    ++script->linesDone;
+                }
+                script->lineDone.notify_all();
+            }
+        }
+    };
+
+    unsigned int numWorkers = getWorkerCount(pending.lines.size());
+    for (unsigned int i = 0; i < numWorkers; ++i)
+        pending.workers.emplace_back(worker);
+}
+
+/* See Assembler.h. */
+const bytestring *Assembler::lookupPendingLine(const std::string &filename,
+                                               int lineno,
+                                               const std::string &instruction)
+{
+    auto it = pendingScripts.find(filename);
+    if (it == pendingScripts.end())
+        return nullptr;
+
+    PendingScript &pending = *it->second;
+    auto index = pending.lineIndex.find(lineno);
+    if (index == pending.lineIndex.end())
+        return nullptr;
+
+    const ScriptLine &line = pending.lines[index->second];
+    {
+        std::unique_lock<std::mutex> lock{pending.mutex};
+        pending.lineDone.wait(lock, [&line]() { return line.done; });
+    }
+
+    // Duplicate lines share the first line's result, so compare them the
+    // same way the cache does
+    if (!line.assembled ||
+        getCacheKey(line.text, line.preludeHash) !=
+            getCacheKey(instruction, prelude.getHash()))
+        return nullptr;
+    return &line.machineCode;
+}
+
+/* See Assembler.h. */
+void Assembler::finishScript(const std::string &filename)
+{
+    auto it = pendingScripts.find(filename);
+    if (it == pendingScripts.end())
+        return;
+
+    std::unique_ptr<PendingScript> pending = std::move(it->second);
+    pendingScripts.erase(it);
+    for (std::thread &worker : pending->workers)
+        worker.join();
+    pending->workers.clear();
+
+    ScriptCache &script = scripts[filename];
+    for (auto &entry : pending->lineIndex) {
+        const ScriptLine &line = pending->lines[entry.second];
+        if (line.assembled)
+            script.add(entry.first, line.text, line.preludeHash,
+                       line.machineCode);
+    }
+
+    if (!pending->cachePath.empty())
+        script.save(pending->cachePath, pending->key);
+}
+
+/* See Assembler.h. */
+int Assembler::assembleInstruction(const std::string &instruction,
+                                   uint64_t address, uint64_t dataEnd,
+                                   bytestring &machineCodeOut,
+                                   std::vector<DataSection> &sectionsOut,
+                                   const Inputter &inputter)
+{
+    waitForContext();
+
+    // Move scripts which are completely assembled into their caches
+    for (auto it = pendingScripts.begin(); it != pendingScripts.end();) {
+        PendingScript &pending = *it->second;
+        std::string filename = it->first;
+        ++it;
+
+        bool done;
+        {
+            std::lock_guard<std::mutex> lock{pending.mutex};
+            done = pending.linesDone == pending.lines.size();
+        }
+        if (done)
+            finishScript(filename);
+    }
+
+    const std::string &filename = inputter.currentFilename();
+    int lineno = inputter.currentLineno();
+    const bytestring *machineCode = nullptr;
+
+    auto script = scripts.find(filename);
+    if (script != scripts.end())
+        machineCode =
+            script->second.lookup(lineno, instruction, prelude.getHash());
+    if (!machineCode)
+        machineCode = lookupPendingLine(filename, lineno, instruction);
+    if (machineCode) {
+        machineCodeOut = *machineCode;
+        sectionsOut.clear();
+        return 0;
+    }
+
+    return assembleCached(instruction, address, dataEnd, machineCodeOut,
+                          sectionsOut, &inputter);
+}
+
+/* See Assembler.h. */
+void Assembler::beginBlock(int lineno)
+{
+    blockOpen = true;
+    blockReady = false;
+    blockImplicit = false;
+    block.clear();
+    blockLineno = lineno;
+}
+
+/* See Assembler.h. */
+bool Assembler::opensBlock(const std::string &line)
+{
+    waitForContext();
+    return prelude.getNesting(line) > 0;
+}
+
+/* See Assembler.h. */
+void Assembler::beginImplicitBlock(const std::string &line, int lineno)
+{
+    beginBlock(lineno);
+    blockImplicit = true;
+    blockNesting = 0;
+    addBlockLine(line);
+}
+
+/* See Assembler.h. */
+void Assembler::addBlockLine(const std::string &line)
+{
+    block += line;
+    block += '\n';
+
+    if (blockImplicit) {
+        waitForContext();
+        blockNesting += prelude.getNesting(line);
+        if (blockNesting <= 0)
+            endBlock();
+    }
+}
+
+/* See Assembler.h. */
+void Assembler::endBlock()
+{
+    blockOpen = false;
+    blockReady = true;
+}
+
+/* See Assembler.h. */
+int Assembler::assembleBlock(uint64_t address, uint64_t dataEnd,
+                             bytestring &machineCodeOut,
+                             std::vector<DataSection> &sectionsOut,
+                             const Inputter &inputter)
+{
+    waitForContext();
+    blockReady = false;
+
+    bool cacheable;
+    int error = assembleUncached(block, address, dataEnd, machineCodeOut,
+                                 sectionsOut, cacheable, &inputter,
+                                 blockLineno);
+    block.clear();
+    return error;
+}
+
+/* See Assembler.h. */
+int Assembler::assembleCached(const std::string &instruction,
+                              uint64_t address, uint64_t dataEnd,
+                              bytestring &machineCodeOut,
+                              std::vector<DataSection> &sectionsOut,
+                              const Inputter *inputter)
+{
+    std::string key = getCacheKey(instruction, prelude.getHash());
+
+    auto it = cacheIndex.find(key);
+    if (it != cacheIndex.end()) {
+        ++cacheHits;
+        cache.splice(cache.begin(), cache, it->second);
+        machineCodeOut = it->second->second;
+        sectionsOut.clear();
+        return 0;
+    }
+
+    ++cacheMisses;
+    bool cacheable;
+    int error = assembleUncached(instruction, address, dataEnd, machineCodeOut,
+                                 sectionsOut, cacheable, inputter,
+                                 inputter ? inputter->currentLineno() : 0);
+    if (error)
+        return error;
+
+    // Only cache successes so that errors are always reported
+    if (!cacheable)
+        return 0;
+    if (cache.size() >= CACHE_CAPACITY) {
+        cacheIndex.erase(cache.back().first);
+        cache.pop_back();
+    }
+    cache.emplace_front(std::move(key), machineCodeOut);
+    cacheIndex[cache.front().first] = cache.begin();
+
+    return 0;
+}
+
+/* See Assembler.h. */
+int Assembler::assembleUncached(const std::string &source, uint64_t address,
+                                uint64_t dataEnd, bytestring &machineCodeOut,
+                                std::vector<DataSection> &sectionsOut,
+                                bool &cacheableOut, const Inputter *inputter,
+                                int lineno)
+{
+    AssemblerPipeline &current = preparePipeline(pipeline, *context);
+
+    // The prelude goes in front of the source, so line numbers are shifted
+    std::unique_ptr<DiagContext> diagContext;
+    if (inputter) {
+        diagContext.reset(
+            new DiagContext{*inputter, lineno - prelude.getLineCount()});
+    }
+
+    int error = current.assemble(*context, prelude.getSource() + source,
+                                 address, dataEnd, &labels, diagContext.get(),
+                                 machineCodeOut, sectionsOut, cacheableOut);
+    if (error)
+        return error;
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+    if (inputter) {
+        for (auto &symbol : current.state.definedSymbols)
+            labels[symbol.first] = symbol.second;
+    }
+#endif
+    if (prelude.add(source)) {
+        cacheableOut = false;
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+        collapsePrelude(prelude, *current.mcCtx);
+#endif
+    }
+    return 0;
+}
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+/* See above. */
+static void collapsePrelude(Prelude &prelude, MCContext &mcCtx)
+{
+    std::vector<std::pair<std::string, int64_t>> constants;
+    for (const std::string &name : prelude.getLastAssigned()) {
+        MCSymbol *symbol = mcCtx.lookupSymbol(name);
+        if (!symbol || !symbol->isVariable())
+            continue;
+        int64_t value;
+        if (!symbol->getVariableValue()->evaluateAsAbsolute(value))
+            return;
+        constants.emplace_back(name, value);
+    }
+    prelude.collapseLast(constants);
+}
+#endif
+
+/* See above. */
+int AssemblerPipeline::assemble(
+    const AssemblerContext &context, std::string source,
+    uint64_t address, uint64_t dataEnd,
+    const std::unordered_map<std::string, uint64_t> *labels,
+    const DiagContext *diagContext, bytestring &machineCodeOut,
+    std::vector<DataSection> &sectionsOut, bool &cacheableOut)
+{
+    const Target *target = context.target;
+    const MCAsmInfo *asmInfo = context.asmInfo.get();
+    const MCInstrInfo *instrInfo = context.instrInfo.get();
+
+    // Set up the input
+    // The source is kept for as long as the source manager so that its
+    // buffer doesn't need a copy of it
+    currentSource = std::move(source);
+    srcMgr.AddNewSourceBuffer(
+        MemoryBuffer::getMemBuffer(currentSource, "assembly"), SMLoc{});
+    srcMgr.setDiagHandler(asmaseDiagHandler,
+                          const_cast<DiagContext *>(diagContext));
 
     // Set up the parser
     OwningPtr<MCAsmParser> parser{
-        createMCAsmParser(srcMgr, mcCtx, *streamer, *asmInfo)};
+        createMCAsmParser(srcMgr, *mcCtx, *streamer, *asmInfo)};
 
 #if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 5)
     MCTargetOptions targetOptions;
@@ -223,13 +1070,53 @@ int Assembler::assembleInstruction(const std::string &instruction,
     assert(TAP && "This target does not support assembly parsing");
     parser->setTargetParser(*TAP);
 
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+    // Lay the code out as if the section started at the beginning of the
+    // page so that alignment directives are relative to the real address.
+    // The padding is stripped from the output.
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t padding = address & (pageSize - 1);
+    state.clear();
+    state.address = address - padding;
+    state.dataEnd = dataEnd;
+    state.labels = labels;
+
+    streamer->InitSections(false);
+    streamer->EmitZeros(padding);
+    if (parser->Run(true) != 0)
+        return 1;
+
+    for (auto &symbol : state.undefinedSymbols) {
+        std::string message = "undefined symbol '" + symbol.first + "'";
+        srcMgr.PrintMessage(symbol.second, SourceMgr::DK_Error, message);
+    }
+    if (!state.undefinedSymbols.empty())
+        return 1;
+
+    cacheableOut = !state.addressDependent;
+    sectionsOut = std::move(state.sections);
+#else
+    // Symbols aren't resolved and other sections are dropped, so nothing
+    // depends on the address
+    (void)address;
+    (void)dataEnd;
+    (void)labels;
+    cacheableOut = true;
+    sectionsOut.clear();
     if (parser->Run(false) != 0)
         return 1;
+#endif
 
 #if LLVM_VERSION_MAJOR < 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR < 8)
     outputStream.flush();
 #endif
-#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 6)
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+    // The capture streamer writes out the raw machine code
+    auto *buffer = reinterpret_cast<const unsigned char *>(outputString.data());
+    machineCodeOut = bytestring{buffer + padding, outputString.size() - padding};
+    return 0;
+#else
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 6
     std::unique_ptr<MemoryBuffer> outputBuffer{
         MemoryBuffer::getMemBuffer(outputString, "machine code", false)};
     auto objFileErr = object::ObjectFile::createELFObjectFile(outputBuffer->getMemBufferRef());
@@ -265,8 +1152,10 @@ int Assembler::assembleInstruction(const std::string &instruction,
         machineCodeOut = bytestring{buffer, textSection.size()};
         return 0;
     }
+#endif
 }
 
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR < 7
 /* See above. */
 static error_code getTextSection(object::ObjectFile &objFile,
                                  StringRef &result) {
@@ -298,17 +1187,20 @@ static error_code getTextSection(object::ObjectFile &objFile,
     }
     return error_code(ENOEXEC, system_category());
 }
+#endif
 
 /* See above. */
 static void asmaseDiagHandler(const SMDiagnostic &diag, void *arg)
 {
-    const Inputter &inputter = *static_cast<const Inputter *>(arg);
+    if (!arg)
+        return;
+    const DiagContext &context = *static_cast<const DiagContext *>(arg);
 
     SMDiagnostic diagnostic{
         *diag.getSourceMgr(),
         diag.getLoc(),
-        inputter.currentFilename().c_str(),
-        inputter.currentLineno(),
+        context.inputter.currentFilename().c_str(),
+        context.lineno + diag.getLineNo() - 1,
         diag.getColumnNo(),
         diag.getKind(),
         diag.getMessage(),
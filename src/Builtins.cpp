@@ -46,7 +46,12 @@ public:
 
 static BUILTIN_FUNC(quit)
 {
-    return -1;
+    return BUILTIN_QUIT;
+}
+
+static BUILTIN_FUNC(reset)
+{
+    return BUILTIN_RESET;
 }
 
 static BUILTIN_FUNC(help);
@@ -57,12 +62,32 @@ static std::map<std::string, BuiltinCommand> commands = {
 
     {"quit",      {builtin_quit, "quit the program"}},
     {"help",      {builtin_help, "print this help information"}},
+    {"reset",     {builtin_reset, "replace the tracee with a fresh one"}},
 
     {"source",    {builtin_source, "redirect input to a given file"}},
 
     {"memory",    {builtin_memory,    "dump memory contents"}},
+    {"disas",     {builtin_disas,     "disassemble memory"}},
     {"registers", {builtin_registers, "dump register contents"}},
 
+    {"write",       {builtin_write,       "write values to memory"}},
+    {"fill",        {builtin_fill,        "fill memory with a repeated pattern"}},
+    {"fill-random", {builtin_fill_random, "fill memory with pseudorandom data"}},
+
+    {"alloc", {builtin_alloc, "map scratch memory in the tracee"}},
+    {"free",  {builtin_free,  "unmap memory mapped by alloc"}},
+    {"load",  {builtin_load,  "load a file into memory"}},
+
+    {"cache",     {builtin_cache,     "show or clear the assembly cache"}},
+    {"encodings", {builtin_encodings, "list the encodings of an instruction"}},
+
+    {"begin",  {builtin_begin,  "start a block of assembly"}},
+    {"end",    {builtin_end,    "assemble and run a block of assembly"}},
+    {"labels", {builtin_labels, "list defined labels"}},
+
+    {"target",  {builtin_target,  "show the target being assembled for"}},
+    {"analyze", {builtin_analyze, "predict and measure the performance of the last code run"}},
+
     {"warranty",  {builtin_warranty, "show warranty information"}},
     {"copying",   {builtin_copying,  "show copying information"}},
 };
@@ -155,7 +180,8 @@ bool isBuiltin(const std::string &str)
 }
 
 /* See Builtins.h. */
-int runBuiltin(const std::string &line, Tracee &tracee, Inputter &inputter)
+int runBuiltin(const std::string &line, Tracee &tracee, Assembler &assembler,
+               Inputter &inputter, JsonWriter *json)
 {
     // Make sure we were really given a built-in and trim the leading colon
     const char *builtin = line.c_str();
@@ -172,7 +198,8 @@ int runBuiltin(const std::string &line, Tracee &tracee, Inputter &inputter)
     Builtins::ErrorContext errorContext{inputter.currentFilename().c_str(),
                                         inputter.currentLineno(),
                                         line.c_str(), offset};
-    Builtins::Environment env{tracee, inputter, errorContext};
+    Builtins::Environment env{tracee, assembler, inputter, errorContext,
+                              json};
 
     // Lex and parse the input
     Builtins::Scanner scanner{builtin};
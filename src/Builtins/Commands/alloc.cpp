@@ -0,0 +1,166 @@
+/*
+ * alloc and free built-in commands for managing scratch memory in the tracee.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Tracee.h"
+
+/** Size of huge pages, which huge page mappings are rounded up to. */
+static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static std::string getAllocUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " [SIZE [FLAG...]]";
+    return ss.str();
+}
+
+static std::string getFreeUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " ADDR";
+    return ss.str();
+}
+
+BUILTIN_FUNC(alloc)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getAllocUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf(
+            "Memory without flags comes from the data arena shared with the\n"
+            "tracee, which can be read and written without any system calls.\n"
+            "Flags:\n"
+            "  hugepage -- back the memory with huge pages (MAP_HUGETLB)\n"
+            "  thp      -- advise the kernel to use transparent huge pages\n"
+            "  populate -- prefault the memory (MAP_POPULATE)\n");
+        return 0;
+    }
+
+    // With no arguments, list what we've allocated so far
+    if (args.empty()) {
+        for (auto &allocation : env.tracee.getArenaAllocations())
+            printf("%p: %zu bytes (arena)\n", allocation.first,
+                   allocation.second);
+        for (auto &mapping : env.tracee.getMappings())
+            printf("%p: %zu bytes\n", mapping.first, mapping.second);
+        return 0;
+    }
+
+    if (checkValueType(*args[0], Builtins::ValueType::INTEGER,
+                       "expected size", env.errorContext))
+        return 1;
+
+    if (args[0]->getInteger() <= 0) {
+        env.errorContext.printMessage("size must be positive",
+                                      args[0]->getStart());
+        return 1;
+    }
+
+    size_t size = args[0]->getInteger();
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    bool thp = false;
+
+    for (size_t i = 1; i < args.size(); ++i) {
+        if (checkValueType(*args[i], Builtins::ValueType::IDENTIFIER,
+                           "expected flag", env.errorContext))
+            return 1;
+
+        const std::string &flag = args[i]->getIdentifier();
+        if (flag == "hugepage")
+            flags |= MAP_HUGETLB;
+        else if (flag == "thp")
+            thp = true;
+        else if (flag == "populate")
+            flags |= MAP_POPULATE;
+        else {
+            env.errorContext.printMessage("unknown flag", args[i]->getStart());
+            return 1;
+        }
+    }
+
+    // Plain allocations come from the arena unless it's full
+    if (args.size() == 1) {
+        void *address = env.tracee.allocateArena(size);
+        if (address) {
+            printf("%p: %zu bytes (arena)\n", address,
+                   env.tracee.getArenaAllocations().at(address));
+            return 0;
+        }
+    }
+
+    if ((flags & MAP_HUGETLB) || thp)
+        size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+    void *address;
+    int error = env.tracee.mapMemory(size, PROT_READ | PROT_WRITE, flags, -1, 0,
+                                     address);
+    if (error)
+        return error;
+
+    if (thp) {
+        long result;
+        error = env.tracee.injectSyscall(
+            SYS_madvise, {(long) address, (long) size, MADV_HUGEPAGE}, result);
+        if (error)
+            return error;
+        if (result < 0)
+            fprintf(stderr, "madvise: %s\n", strerror(-result));
+    }
+
+    printf("%p: %zu bytes\n", address, size);
+    return 0;
+}
+
+BUILTIN_FUNC(free)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getFreeUsage(commandName);
+        printf("%s\n", usage.c_str());
+        return 0;
+    }
+
+    if (args.size() != 1) {
+        std::string usage = getFreeUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    if (checkValueType(*args[0], Builtins::ValueType::INTEGER,
+                       "expected address", env.errorContext))
+        return 1;
+
+    void *address = reinterpret_cast<void *>(args[0]->getInteger());
+    if (!env.tracee.freeArena(address))
+        return 0;
+    return env.tracee.unmapMemory(address);
+}
@@ -0,0 +1,90 @@
+/*
+ * analyze built-in command for scheduling-model analysis of code.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <sstream>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Analyzer.h"
+#include "Assembler.h"
+#include "Tracee.h"
+
+/** Number of iterations shown in the timeline by default. */
+static const long DEFAULT_ITERATIONS = 2;
+
+/** Maximum number of iterations shown in the timeline. */
+static const long MAX_ITERATIONS = 100;
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " [ITERATIONS]";
+    return ss.str();
+}
+
+BUILTIN_FUNC(analyze)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf(
+            "Analyze the last line or block that was run as a loop body with\n"
+            "the scheduling model of the target CPU. The timeline shows the\n"
+            "given number of iterations (default %ld). Measured cycles and\n"
+            "instructions come from the performance counters, if available.\n",
+            DEFAULT_ITERATIONS);
+        return 0;
+    }
+
+    if (args.size() > 1) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    long iterations = DEFAULT_ITERATIONS;
+    if (args.size() == 1) {
+        if (checkValueType(*args[0], Builtins::ValueType::INTEGER,
+                           "expected number of iterations", env.errorContext))
+            return 1;
+
+        iterations = args[0]->getInteger();
+        if (iterations < 1 || iterations > MAX_ITERATIONS) {
+            env.errorContext.printMessage(
+                "number of iterations must be between 1 and 100",
+                args[0]->getStart());
+            return 1;
+        }
+    }
+
+    const CodeRun &run = env.tracee.getLastRun();
+    if (run.machineCode.empty()) {
+        fprintf(stderr, "no code has been run\n");
+        return 1;
+    }
+
+    return analyzeCode(env.assembler.getContext(), run, iterations);
+}
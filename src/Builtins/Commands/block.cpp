@@ -0,0 +1,87 @@
+/*
+ * Built-in commands for assembling blocks of several lines at once.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <sstream>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Assembler.h"
+#include "Inputter.h"
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName;
+    return ss.str();
+}
+
+BUILTIN_FUNC(begin)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        return 0;
+    }
+
+    if (args.size() != 0) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    if (env.assembler.inBlock()) {
+        env.errorContext.printMessage("already in a block", commandStart);
+        return 1;
+    }
+
+    // The block starts on the next line
+    env.assembler.beginBlock(env.inputter.currentLineno() + 1);
+    return 0;
+}
+
+BUILTIN_FUNC(end)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        return 0;
+    }
+
+    if (args.size() != 0) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    if (!env.assembler.inBlock()) {
+        env.errorContext.printMessage("not in a block", commandStart);
+        return 1;
+    }
+
+    // The block is assembled and run once we're back in the main loop
+    env.assembler.endBlock();
+    return 0;
+}
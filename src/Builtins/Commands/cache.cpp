@@ -0,0 +1,83 @@
+/*
+ * cache built-in command for inspecting the assembly cache.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <sstream>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Assembler.h"
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " [clear]";
+    return ss.str();
+}
+
+BUILTIN_FUNC(cache)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        return 0;
+    }
+
+    if (args.size() > 1) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    Assembler &assembler = env.assembler;
+
+    if (args.size() == 1) {
+        if (checkValueType(*args[0], Builtins::ValueType::IDENTIFIER,
+                           "expected clear", env.errorContext))
+            return 1;
+
+        if (args[0]->getIdentifier() != "clear") {
+            env.errorContext.printMessage("expected clear",
+                                          args[0]->getStart());
+            return 1;
+        }
+
+        assembler.clearCache();
+        return 0;
+    }
+
+    size_t hits = assembler.getCacheHits();
+    size_t misses = assembler.getCacheMisses();
+    size_t lookups = hits + misses;
+
+    printf("entries: %zu/%zu\n", assembler.getCacheSize(),
+           Assembler::CACHE_CAPACITY);
+    printf("hits:    %zu\n", hits);
+    printf("misses:  %zu\n", misses);
+    if (lookups)
+        printf("hit rate: %.1f%%\n", 100.0 * hits / lookups);
+
+    return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * disas built-in command for disassembling tracee memory.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include <unistd.h>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Assembler.h"
+#include "Disassembler.h"
+#include "Tracee.h"
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+
+/** Number of instructions to disassemble by default. */
+static const long DEFAULT_COUNT = 10;
+
+/** Number of bytes of encoding to leave room for before the instruction. */
+static const size_t ENCODING_COLUMN_BYTES = 10;
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " ADDR [COUNT]";
+    return ss.str();
+}
+
+/** An instruction which has already been decoded and printed. */
+class CachedInstruction {
+public:
+    bytestring machineCode;
+    std::string text;
+};
+
+/**
+ * Maximum number of cached instructions. The cache is cleared when it grows
+ * past this so that it can't grow without bound.
+ */
+static const size_t CACHE_CAPACITY = 1 << 16;
+
+/**
+ * Printed instructions keyed by address. An entry is only used if the bytes
+ * at its address are still the same, so a region stays cached until it is
+ * rewritten (by us or by the tracee).
+ */
+static std::unordered_map<uint64_t, CachedInstruction> cache;
+
+/**
+ * Read as much of the given range of tracee memory as possible, a page at a
+ * time from the end.
+ * @return Zero on success, nonzero if not even the first byte is readable.
+ */
+static int readCode(Tracee &tracee, uint64_t address, size_t size,
+                    bytestring &codeOut)
+{
+    uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    const void *start = reinterpret_cast<const void *>(address);
+
+    while (size > 0) {
+        codeOut.resize(size);
+        if (!tracee.readMemory(start, &codeOut[0], size))
+            return 0;
+
+        // Drop the last page (or partial page) and try again
+        uint64_t lastPage = (address + size - 1) & ~(pageSize - 1);
+        size = lastPage > address ? lastPage - address : 0;
+    }
+
+    codeOut.clear();
+    return 1;
+}
+
+/** Print an encoding, padded to line up the instructions. */
+static void printEncoding(const bytestring &machineCode)
+{
+    size_t i;
+    for (i = 0; i < machineCode.size(); ++i)
+        printf(" %02x", machineCode[i]);
+    for (; i < ENCODING_COLUMN_BYTES; ++i)
+        printf("   ");
+}
+
+BUILTIN_FUNC(disas)
+{
+    static std::unique_ptr<Disassembler> disassembler;
+
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        return 0;
+    }
+
+    if (args.size() < 1 || args.size() > 2) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    if (checkValueType(*args[0], Builtins::ValueType::INTEGER,
+                       "expected address", env.errorContext))
+        return 1;
+    uint64_t address = args[0]->getInteger();
+
+    long count = DEFAULT_COUNT;
+    if (args.size() > 1) {
+        if (checkValueType(*args[1], Builtins::ValueType::INTEGER,
+                           "expected instruction count", env.errorContext))
+            return 1;
+
+        count = args[1]->getInteger();
+        if (count < 1) {
+            env.errorContext.printMessage("count must be positive",
+                                          args[1]->getStart());
+            return 1;
+        }
+    }
+
+    if (!disassembler)
+        disassembler.reset(new Disassembler{env.assembler.getContext()});
+
+    // Read everything that the instructions could possibly cover at once
+    bytestring code;
+    if (readCode(env.tracee, address,
+                 count * disassembler->getMaxInstructionLength(), code)) {
+        fprintf(stderr, "cannot access memory at address 0x%" PRIx64 "\n",
+                address);
+        return 1;
+    }
+
+    std::unordered_map<uint64_t, std::string> labelsByAddress;
+    for (auto &label : env.assembler.getLabels())
+        labelsByAddress.emplace(label.second, label.first);
+
+    if (cache.size() > CACHE_CAPACITY)
+        cache.clear();
+
+    size_t offset = 0;
+    for (long i = 0; i < count && offset < code.size(); ++i) {
+        uint64_t instructionAddress = address + offset;
+        CachedInstruction printed;
+
+        auto it = cache.find(instructionAddress);
+        if (it != cache.end() &&
+            code.compare(offset, it->second.machineCode.size(),
+                         it->second.machineCode) == 0)
+            printed = it->second;
+        else {
+            DisassembledInstruction instruction;
+            disassembler->decodeInstruction(code, offset, address,
+                                            instruction);
+            printed.machineCode = std::move(instruction.machineCode);
+
+            // The end of what we could read might cut an instruction short,
+            // so don't remember invalid instructions
+            if (instruction.valid) {
+                printed.text = disassembler->printInstruction(instruction.inst);
+                cache[instructionAddress] = printed;
+            } else {
+                printed.text = "(bad)";
+                cache.erase(instructionAddress);
+            }
+        }
+
+        auto label = labelsByAddress.find(instructionAddress);
+        if (label != labelsByAddress.end())
+            printf("%s:\n", label->second.c_str());
+        printf("0x%016" PRIx64 ":", instructionAddress);
+        printEncoding(printed.machineCode);
+        printf("  %s\n", printed.text.c_str());
+        offset += printed.machineCode.size();
+    }
+
+    return 0;
+}
+
+#else
+
+BUILTIN_FUNC(disas)
+{
+    fprintf(stderr, "disassembly requires LLVM 3.7 or newer\n");
+    return 1;
+}
+
+#endif
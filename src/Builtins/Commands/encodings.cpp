@@ -0,0 +1,140 @@
+/*
+ * encodings built-in command for listing the encodings of an instruction.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Assembler.h"
+#include "Disassembler.h"
+#include "Tracee.h"
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+
+/** Number of bytes of encoding to leave room for before the opcode name. */
+static const size_t ENCODING_COLUMN_BYTES = 10;
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " INSTRUCTION";
+    return ss.str();
+}
+
+/** Print an encoding and its size. */
+static void printEncoding(const bytestring &machineCode, bool chosen,
+                          const std::string &name)
+{
+    printf("%c %2zu ", chosen ? '*' : ' ', machineCode.size());
+    size_t i;
+    for (i = 0; i < machineCode.size(); ++i)
+        printf(" %02x", machineCode[i]);
+    for (; i < ENCODING_COLUMN_BYTES; ++i)
+        printf("   ");
+    printf("  %s\n", name.c_str());
+}
+
+BUILTIN_FUNC(encodings)
+{
+    static std::unique_ptr<Disassembler> disassembler;
+
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf(
+            "List the encodings of an instruction given as a string and their\n"
+            "sizes in bytes. The encoding that the assembler picks is marked\n"
+            "with *.\n");
+        return 0;
+    }
+
+    if (args.size() != 1) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    if (checkValueType(*args[0], Builtins::ValueType::STRING,
+                       "expected instruction string", env.errorContext))
+        return 1;
+
+    // Assemble it where it would go if it were run so that PC-relative
+    // operands come out the same
+    bytestring machineCode;
+    std::vector<DataSection> sections;
+    uint64_t address = reinterpret_cast<uintptr_t>(env.tracee.getCodeAddress());
+    uint64_t dataEnd = reinterpret_cast<uintptr_t>(env.tracee.getDataEnd());
+    if (env.assembler.assembleInstruction(args[0]->getString(), address,
+                                          dataEnd, machineCode, sections,
+                                          env.inputter))
+        return 1;
+
+    if (!disassembler)
+        disassembler.reset(new Disassembler{env.assembler.getContext()});
+
+    DisassembledInstruction instruction;
+    if (!machineCode.empty())
+        disassembler->decodeInstruction(machineCode, 0, address, instruction);
+    if (machineCode.empty() || !instruction.valid ||
+        instruction.machineCode.size() != machineCode.size()) {
+        env.errorContext.printMessage("expected a single instruction",
+                                      args[0]->getStart());
+        return 1;
+    }
+
+    std::vector<InstructionEncoding> encodings;
+    disassembler->findEncodings(instruction.inst, encodings);
+
+    printf("%s\n", disassembler->printInstruction(instruction.inst).c_str());
+
+    // The code emitter makes some choices itself (e.g., the displacement
+    // size), so what the assembler picked might not have been found
+    bool found = false;
+    for (const InstructionEncoding &encoding : encodings) {
+        if (encoding.machineCode == machineCode)
+            found = true;
+    }
+    if (!found)
+        printEncoding(machineCode, true, "(assembled)");
+
+    for (const InstructionEncoding &encoding : encodings)
+        printEncoding(encoding.machineCode, encoding.machineCode == machineCode,
+                      encoding.opcodeName);
+
+    return 0;
+}
+
+#else
+
+BUILTIN_FUNC(encodings)
+{
+    fprintf(stderr, "listing encodings requires LLVM 3.7 or newer\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * fill and fill-random built-in commands for initializing tracee memory.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Support.h"
+#include "Tracee.h"
+
+using Builtins::lookupSizeSpecifier;
+
+/**
+ * Maximum amount of data to generate before writing it to the tracee. Large
+ * fills are written in chunks of this size so that we don't need to allocate a
+ * buffer as big as the whole region.
+ */
+static const size_t CHUNK_SIZE = 1 << 20;
+
+static std::string getFillUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " ADDR LENGTH PATTERN [SIZE]";
+    return ss.str();
+}
+
+static std::string getFillRandomUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " ADDR LENGTH [SEED]";
+    return ss.str();
+}
+
+/**
+ * Parse the address and length arguments common to the fill commands.
+ * @return Zero on success, nonzero on failure.
+ */
+static int parseRegion(const std::vector<std::unique_ptr<Builtins::ValueAST>> &args,
+                       Builtins::Environment &env,
+                       unsigned char *&address, size_t &length)
+{
+    if (checkValueType(*args[0], Builtins::ValueType::INTEGER,
+                       "expected address", env.errorContext))
+        return 1;
+
+    if (checkValueType(*args[1], Builtins::ValueType::INTEGER,
+                       "expected length", env.errorContext))
+        return 1;
+
+    if (args[1]->getInteger() < 0) {
+        env.errorContext.printMessage("length cannot be negative",
+                                      args[1]->getStart());
+        return 1;
+    }
+
+    address = reinterpret_cast<unsigned char *>(args[0]->getInteger());
+    length = args[1]->getInteger();
+    return 0;
+}
+
+BUILTIN_FUNC(fill)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getFillUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf(
+            "Patterns:\n"
+            "  INTEGER -- repeated with the given size (default b)\n"
+            "  STRING  -- repeated byte for byte\n");
+        return 0;
+    }
+
+    if (args.size() < 3 || args.size() > 4) {
+        std::string usage = getFillUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    unsigned char *address;
+    size_t length;
+    if (parseRegion(args, env, address, length))
+        return 1;
+
+    size_t size = 1;
+    if (args.size() > 3) {
+        if (checkValueType(*args[3], Builtins::ValueType::IDENTIFIER,
+                           "expected size specifier", env.errorContext))
+            return 1;
+
+        size = lookupSizeSpecifier(args[3]->getIdentifier());
+        if (!size) {
+            env.errorContext.printMessage("invalid size specifier",
+                                          args[3]->getStart());
+            return 1;
+        }
+    }
+
+    bytestring pattern;
+    switch (args[2]->getType()) {
+        case Builtins::ValueType::INTEGER: {
+            uint64_t value = args[2]->getInteger();
+            pattern.assign(reinterpret_cast<const unsigned char *>(&value),
+                           sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            pattern.erase(0, sizeof(value) - size);
+#else
+            pattern.resize(size);
+#endif
+            break;
+        }
+        case Builtins::ValueType::STRING: {
+            if (args.size() > 3) {
+                env.errorContext.printMessage(
+                    "size is invalid with string pattern", args[3]->getStart());
+                return 1;
+            }
+            const std::string &str = args[2]->getString();
+            pattern.assign(reinterpret_cast<const unsigned char *>(str.data()),
+                           str.size());
+            break;
+        }
+        default:
+            env.errorContext.printMessage("expected integer or string pattern",
+                                          args[2]->getStart());
+            return 1;
+    }
+
+    if (pattern.empty()) {
+        env.errorContext.printMessage("pattern cannot be empty",
+                                      args[2]->getStart());
+        return 1;
+    }
+
+    // Expand the pattern into a chunk which is a whole number of repetitions
+    // so that consecutive chunks line up
+    size_t chunkSize = std::min(length, CHUNK_SIZE);
+    chunkSize = std::max(chunkSize - chunkSize % pattern.size(), pattern.size());
+    bytestring chunk;
+    chunk.reserve(chunkSize);
+    while (chunk.size() < chunkSize)
+        chunk += pattern;
+
+    while (length > 0) {
+        size_t amount = std::min(length, chunk.size());
+        if (env.tracee.writeMemory(address, chunk.data(), amount))
+            return 1;
+        address += amount;
+        length -= amount;
+    }
+
+    return 0;
+}
+
+/**
+ * SplitMix64 pseudorandom number generator. This is fast and deterministic for
+ * a given seed, which is all we need for generating test inputs.
+ */
+static inline uint64_t splitMix64(uint64_t &state)
+{
+    uint64_t z = (state += UINT64_C(0x9e3779b97f4a7c15));
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+BUILTIN_FUNC(fill_random)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getFillRandomUsage(commandName);
+        printf("%s\n", usage.c_str());
+        return 0;
+    }
+
+    if (args.size() < 2 || args.size() > 3) {
+        std::string usage = getFillRandomUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    unsigned char *address;
+    size_t length;
+    if (parseRegion(args, env, address, length))
+        return 1;
+
+    uint64_t state = 0;
+    if (args.size() > 2) {
+        if (checkValueType(*args[2], Builtins::ValueType::INTEGER,
+                           "expected seed", env.errorContext))
+            return 1;
+        state = args[2]->getInteger();
+    }
+
+    bytestring chunk(std::min(length, CHUNK_SIZE), 0);
+    while (length > 0) {
+        size_t amount = std::min(length, chunk.size());
+        for (size_t i = 0; i < amount; i += sizeof(uint64_t)) {
+            uint64_t value = splitMix64(state);
+            memcpy(&chunk[i], &value, std::min(sizeof(value), amount - i));
+        }
+
+        if (env.tracee.writeMemory(address, chunk.data(), amount))
+            return 1;
+        address += amount;
+        length -= amount;
+    }
+
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * load built-in command for loading files into tracee memory.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Tracee.h"
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " FILE [ADDR]";
+    return ss.str();
+}
+
+/**
+ * Get the size of a file open in the tracee.
+ * @return Zero on success, positive on error, negative on fatal error.
+ */
+static int getFileSize(Tracee &tracee, int fd, size_t &sizeOut)
+{
+    long result;
+    int error = tracee.injectSyscall(SYS_lseek, {fd, 0, SEEK_END}, result);
+    if (error)
+        return error;
+    if (result < 0) {
+        fprintf(stderr, "lseek: %s\n", strerror(-result));
+        return 1;
+    }
+
+    sizeOut = result;
+    return 0;
+}
+
+/**
+ * Read a whole file open in the tracee into the given address.
+ * @return Zero on success, positive on error, negative on fatal error.
+ */
+static int readFile(Tracee &tracee, int fd, unsigned char *address,
+                    size_t size, size_t &sizeOut)
+{
+    long result;
+    int error;
+
+    // getFileSize() left us at the end of the file
+    error = tracee.injectSyscall(SYS_lseek, {fd, 0, SEEK_SET}, result);
+    if (error)
+        return error;
+    if (result < 0) {
+        fprintf(stderr, "lseek: %s\n", strerror(-result));
+        return 1;
+    }
+
+    sizeOut = 0;
+    while (sizeOut < size) {
+        error = tracee.injectSyscall(SYS_read,
+                                     {fd, (long) (address + sizeOut),
+                                      (long) (size - sizeOut)},
+                                     result);
+        if (error)
+            return error;
+        if (result < 0) {
+            fprintf(stderr, "read: %s\n", strerror(-result));
+            return 1;
+        }
+        if (result == 0)
+            break;
+        sizeOut += result;
+    }
+
+    return 0;
+}
+
+BUILTIN_FUNC(load)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        return 0;
+    }
+
+    if (args.size() < 1 || args.size() > 2) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    if (checkValueType(*args[0], Builtins::ValueType::STRING,
+                       "expected filename", env.errorContext))
+        return 1;
+
+    unsigned char *address = nullptr;
+    if (args.size() > 1) {
+        if (checkValueType(*args[1], Builtins::ValueType::INTEGER,
+                           "expected address", env.errorContext))
+            return 1;
+        address = reinterpret_cast<unsigned char *>(args[1]->getInteger());
+    }
+
+    Tracee &tracee = env.tracee;
+    int fd;
+    int error = tracee.openFile(args[0]->getString(), O_RDONLY, fd);
+    if (error)
+        return error;
+
+    size_t size;
+    error = getFileSize(tracee, fd, size);
+    if (!error) {
+        if (address) {
+            // Read into the region the user gave us
+            error = readFile(tracee, fd, address, size, size);
+        } else if (size == 0) {
+            fprintf(stderr, "cannot map empty file\n");
+            error = 1;
+        } else {
+            // Map the file directly so nothing is copied at all
+            void *mapped;
+            error = tracee.mapMemory(size, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE, fd, 0, mapped);
+            address = static_cast<unsigned char *>(mapped);
+        }
+    }
+
+    int closeError = tracee.closeFile(fd);
+    if (error)
+        return error;
+    if (closeError < 0)
+        return closeError;
+
+    printf("%p: %zu bytes\n", static_cast<void *>(address), size);
+    return 0;
+}
@@ -30,6 +30,7 @@
 #include "Builtins/ErrorContext.h"
 #include "Builtins/Support.h"
 
+#include "JsonWriter.h"
 #include "MemoryStreamer.h"
 #include "Support.h"
 #include "Tracee.h"
@@ -171,10 +172,10 @@ static int dumpStrings(MemoryStreamer &memStr, size_t repeat)
     return (error) ? 1 : 0;
 }
 
-static int doDump(pid_t pid, Builtins::ErrorContext &errorContext,
+static int doDump(Tracee &tracee, Builtins::ErrorContext &errorContext,
            void *address, size_t repeat, Format format, size_t size)
 {
-    MemoryStreamer memStr{pid, address};
+    MemoryStreamer memStr{tracee, address};
 
     switch (format) {
         case Format::DECIMAL:
@@ -273,6 +274,148 @@ static int doDump(pid_t pid, Builtins::ErrorContext &errorContext,
     }
 }
 
+/**
+ * Write memory as the "memory" member of the open JSON object, which has the
+ * starting address and an array of values.
+ */
+template <typename T, typename Writer>
+static int writeMemoryWith(MemoryStreamer &memStr, size_t repeat,
+                           JsonWriter &json, Writer writer)
+{
+    json.key("memory");
+    json.beginObject();
+    json.key("address");
+    json.hexValue(reinterpret_cast<uintptr_t>(memStr.getAddress()));
+    json.key("values");
+    json.beginArray();
+
+    for (size_t i = 0; i < repeat; ++i) {
+        T value;
+        if (memStr.next(value))
+            return 1;
+        writer(value);
+    }
+
+    json.endArray();
+    json.endObject();
+    return 0;
+}
+
+/** Write memory as unsigned integers. */
+template <typename T>
+static int writeUnsigned(MemoryStreamer &memStr, size_t repeat,
+                         JsonWriter &json)
+{
+    return writeMemoryWith<T>(memStr, repeat, json,
+                              [&json](T value) { json.uintValue(value); });
+}
+
+/** Write memory as signed integers. */
+template <typename T>
+static int writeSigned(MemoryStreamer &memStr, size_t repeat, JsonWriter &json)
+{
+    return writeMemoryWith<T>(memStr, repeat, json,
+                              [&json](T value) { json.intValue(value); });
+}
+
+/**
+ * Write memory as JSON instead of dumping it. The format only decides how the
+ * memory is interpreted: integers are written as numbers (signed for the
+ * decimal format), floating point values as numbers, characters and strings
+ * as strings, and addresses as hexadecimal strings.
+ */
+static int writeMemory(Tracee &tracee, JsonWriter &json,
+                       Builtins::ErrorContext &errorContext, void *address,
+                       size_t repeat, Format format, size_t size)
+{
+    MemoryStreamer memStr{tracee, address};
+
+    switch (format) {
+        case Format::DECIMAL:
+            switch (size) {
+                case Size::BYTE:
+                    return writeSigned<int8_t>(memStr, repeat, json);
+                case Size::HALFWORD:
+                    return writeSigned<int16_t>(memStr, repeat, json);
+                case Size::WORD:
+                    return writeSigned<int32_t>(memStr, repeat, json);
+                case Size::GIANT:
+                    return writeSigned<int64_t>(memStr, repeat, json);
+            }
+            return 1;
+        case Format::UNSIGNED_DECIMAL:
+        case Format::OCTAL:
+        case Format::HEXADECIMAL:
+        case Format::BINARY:
+            switch (size) {
+                case Size::BYTE:
+                    return writeUnsigned<uint8_t>(memStr, repeat, json);
+                case Size::HALFWORD:
+                    return writeUnsigned<uint16_t>(memStr, repeat, json);
+                case Size::WORD:
+                    return writeUnsigned<uint32_t>(memStr, repeat, json);
+                case Size::GIANT:
+                    return writeUnsigned<uint64_t>(memStr, repeat, json);
+            }
+            return 1;
+        case Format::FLOAT: {
+            auto floatWriter = [&json](double value) { json.doubleValue(value); };
+            switch (size) {
+                case Size::WORD:
+                    return writeMemoryWith<float>(memStr, repeat, json,
+                                                  floatWriter);
+                case Size::GIANT:
+                    return writeMemoryWith<double>(memStr, repeat, json,
+                                                   floatWriter);
+                default:
+                    errorContext.printMessage("invalid size for float");
+                    return 1;
+            }
+        }
+        case Format::CHARACTER:
+            if (size != Size::BYTE) {
+                errorContext.printMessage("invalid size for character");
+                return 1;
+            }
+            return writeMemoryWith<char>(
+                memStr, repeat, json,
+                [&json](char c) { json.stringValue(std::string(1, c)); });
+        case Format::ADDRESS:
+            if (size != sizeof(void*)) {
+                errorContext.printMessage("invalid size for address");
+                return 1;
+            }
+            return writeMemoryWith<uintptr_t>(
+                memStr, repeat, json,
+                [&json](uintptr_t value) { json.hexValue(value); });
+        case Format::STRING: {
+            json.key("memory");
+            json.beginObject();
+            json.key("address");
+            json.hexValue(reinterpret_cast<uintptr_t>(address));
+            json.key("values");
+            json.beginArray();
+            for (size_t i = 0; i < repeat; ++i) {
+                std::string str;
+                for (;;) {
+                    char c;
+                    if (memStr.next(c))
+                        return 1;
+                    if (!c)
+                        break;
+                    str += c;
+                }
+                json.stringValue(str);
+            }
+            json.endArray();
+            json.endObject();
+            return 0;
+        }
+        default:
+            return 1;
+    }
+}
+
 BUILTIN_FUNC(memory)
 {
     static size_t repeat = 1;
@@ -374,7 +517,12 @@ BUILTIN_FUNC(memory)
         size = sizeMap[sizeStr];
     }
 
-    if (doDump(env.tracee.getPid(), env.errorContext, address, repeat, format, size))
+    if (env.json) {
+        return writeMemory(env.tracee, *env.json, env.errorContext, address,
+                           repeat, format, size);
+    }
+
+    if (doDump(env.tracee, env.errorContext, address, repeat, format, size))
         return 1;
 
     return 0;
@@ -29,7 +29,9 @@
 #include "Builtins/ErrorContext.h"
 #include "Builtins/Support.h"
 
+#include "JsonWriter.h"
 #include "RegisterCategory.h"
+#include "RegisterDesc.h"
 #include "Tracee.h"
 
 using Builtins::findWithDefault;
@@ -110,6 +112,22 @@ BUILTIN_FUNC(registers)
     if (!any(categories)) // This will be the case if there weren't any args
         categories = defaultCategories;
 
+    if (env.json) {
+        std::vector<std::pair<const RegisterDesc *,
+                              std::shared_ptr<RegisterValue>>> values;
+        if (env.tracee.getRegisterValues(categories, values))
+            return 1;
+
+        env.json->key("registers");
+        env.json->beginObject();
+        for (auto &value : values) {
+            env.json->key(value.first->name.c_str());
+            env.json->registerValue(*value.second);
+        }
+        env.json->endObject();
+        return 0;
+    }
+
     env.tracee.printRegisters(categories);
 
     return 0;
@@ -28,6 +28,7 @@
 #include "Builtins/ErrorContext.h"
 #include "Builtins/Support.h"
 
+#include "Assembler.h"
 #include "Inputter.h"
 
 static std::string getUsage(const std::string &commandName)
@@ -60,5 +61,8 @@ BUILTIN_FUNC(source)
     if (env.inputter.redirectInput(filename))
         return 1;
 
+    // This is only an optimization, so it's fine if it fails
+    env.assembler.loadScript(filename);
+
     return 0;
 }
@@ -0,0 +1,133 @@
+/*
+ * write built-in command for storing values in tracee memory.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <sstream>
+
+#include "Builtins/AST.h"
+#include "Builtins/Commands.h"
+#include "Builtins/Environment.h"
+#include "Builtins/ErrorContext.h"
+#include "Builtins/Support.h"
+
+#include "Support.h"
+#include "Tracee.h"
+
+using Builtins::lookupSizeSpecifier;
+
+static std::string getUsage(const std::string &commandName)
+{
+    std::stringstream ss;
+    ss << "usage: " << commandName << " ADDR VALUE...";
+    return ss.str();
+}
+
+/** Append the in-memory representation of a value to a buffer. */
+template <typename T>
+static void appendValue(bytestring &buffer, T value)
+{
+    buffer.append(reinterpret_cast<const unsigned char *>(&value), sizeof(T));
+}
+
+BUILTIN_FUNC(write)
+{
+    if (wantsHelp(args)) {
+        std::string usage = getUsage(commandName);
+        printf("%s\n", usage.c_str());
+        printf(
+            "Values:\n"
+            "  INTEGER -- stored using the current size\n"
+            "  FLOAT   -- stored as a float (w) or double (g)\n"
+            "  STRING  -- stored as bytes without a terminating null\n"
+            "  SIZE    -- set the current size (b, h, w, or g; default g)\n");
+        return 0;
+    }
+
+    if (args.size() < 2) {
+        std::string usage = getUsage(commandName);
+        env.errorContext.printMessage(usage.c_str(), commandStart);
+        return 1;
+    }
+
+    if (checkValueType(*args[0], Builtins::ValueType::INTEGER,
+                       "expected address", env.errorContext))
+        return 1;
+
+    void *address = reinterpret_cast<void *>(args[0]->getInteger());
+
+    // Build up the whole buffer first so that it is written all at once
+    bytestring buffer;
+    size_t size = 8;
+    for (size_t i = 1; i < args.size(); ++i) {
+        const Builtins::ValueAST &arg = *args[i];
+
+        switch (arg.getType()) {
+            case Builtins::ValueType::IDENTIFIER:
+                size = lookupSizeSpecifier(arg.getIdentifier());
+                if (!size) {
+                    env.errorContext.printMessage("invalid size specifier",
+                                                  arg.getStart());
+                    return 1;
+                }
+                break;
+            case Builtins::ValueType::INTEGER:
+                switch (size) {
+                    case 1:
+                        appendValue<uint8_t>(buffer, arg.getInteger());
+                        break;
+                    case 2:
+                        appendValue<uint16_t>(buffer, arg.getInteger());
+                        break;
+                    case 4:
+                        appendValue<uint32_t>(buffer, arg.getInteger());
+                        break;
+                    case 8:
+                        appendValue<uint64_t>(buffer, arg.getInteger());
+                        break;
+                }
+                break;
+            case Builtins::ValueType::FLOAT:
+                if (size == sizeof(float))
+                    appendValue<float>(buffer, arg.getFloat());
+                else if (size == sizeof(double))
+                    appendValue<double>(buffer, arg.getFloat());
+                else {
+                    env.errorContext.printMessage("invalid size for float",
+                                                  arg.getStart());
+                    return 1;
+                }
+                break;
+            case Builtins::ValueType::STRING: {
+                const std::string &str = arg.getString();
+                buffer.append(
+                    reinterpret_cast<const unsigned char *>(str.data()),
+                    str.size());
+                break;
+            }
+        }
+    }
+
+    if (env.tracee.writeMemory(address, buffer.data(), buffer.size()))
+        return 1;
+
+    return 0;
+}
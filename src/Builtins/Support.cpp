@@ -41,6 +41,20 @@ bool wantsHelp(const std::vector<std::unique_ptr<ValueAST>> &args)
            args[0]->getIdentifier() == "help";
 }
 
+size_t lookupSizeSpecifier(const std::string &sizeStr)
+{
+    if (sizeStr == "b")
+        return 1;
+    else if (sizeStr == "h")
+        return 2;
+    else if (sizeStr == "w")
+        return 4;
+    else if (sizeStr == "g")
+        return 8;
+    else
+        return 0;
+}
+
 std::string escapeCharacter(char c, bool escapeSingleQuote,
                             bool escapeDoubleQuote, bool escapeBackslash)
 {
@@ -0,0 +1,337 @@
+/*
+ * Streamer which captures machine code without writing an object file.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "CaptureStreamer.h"
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/MC/MCAsmBackend.h>
+#include <llvm/MC/MCAssembler.h>
+#include <llvm/MC/MCContext.h>
+#include <llvm/MC/MCFixup.h>
+#include <llvm/MC/MCObjectFileInfo.h>
+#include <llvm/MC/MCObjectWriter.h>
+#include <llvm/MC/MCSection.h>
+#include <llvm/MC/MCStreamer.h>
+#include <llvm/MC/MCSymbol.h>
+#include <llvm/MC/MCValue.h>
+#include <llvm/Support/raw_ostream.h>
+using namespace llvm;
+
+/** Return the text section for an assembler. */
+static const MCSection *getTextSection(const MCAssembler &Asm)
+{
+    return Asm.getContext().getObjectFileInfo()->getTextSection();
+}
+
+/**
+ * Object writer which writes out the contents of the text section. Other
+ * sections are placed below state.dataEnd and returned in the state.
+ * Relocations are applied directly.
+ */
+class CaptureObjectWriter : public MCObjectWriter {
+    CaptureState &state;
+
+    /** Addresses of the sections which have been placed. */
+    std::unordered_map<const MCSection *, uint64_t> sectionAddresses;
+
+    /**
+     * Get the address of a placed section.
+     * @return true if the section was placed, false if it wasn't.
+     */
+    bool getSectionAddress(const MCSection *section, uint64_t &addressOut)
+    {
+        auto it = sectionAddresses.find(section);
+        if (it == sectionAddresses.end())
+            return false;
+        addressOut = it->second;
+        return true;
+    }
+
+    /**
+     * Get the address to add to a fixup's value for a symbol it references.
+     * For a symbol defined in this unit, this is the address of its section,
+     * since the assembler already added the symbol's offset in the section.
+     * For an undefined symbol, this is the address of the label defined by
+     * earlier code.
+     * @return true if the address is known, false if it isn't.
+     */
+    bool getSymbolBase(const MCSymbol &symbol, const MCFixup &Fixup,
+                       uint64_t &addressOut)
+    {
+        if (symbol.isInSection())
+            return getSectionAddress(&symbol.getSection(), addressOut);
+
+        if (symbol.isUndefined()) {
+            if (state.labels) {
+                auto it = state.labels->find(symbol.getName());
+                if (it != state.labels->end()) {
+                    addressOut = it->second;
+                    return true;
+                }
+            }
+            state.undefinedSymbols.emplace_back(symbol.getName(),
+                                                Fixup.getLoc());
+        }
+
+        return false;
+    }
+
+public:
+    CaptureObjectWriter(raw_pwrite_stream &OS, bool isLittleEndian,
+                        CaptureState &state)
+        : MCObjectWriter{OS, isLittleEndian}, state(state) {}
+
+    void reset() override
+    {
+        sectionAddresses.clear();
+        MCObjectWriter::reset();
+    }
+
+    void executePostLayoutBinding(MCAssembler &Asm,
+                                  const MCAsmLayout &Layout) override
+    {
+        // Sections from earlier assembly may have been freed, and new ones
+        // can be allocated at the same addresses, so start over
+        sectionAddresses.clear();
+
+        const MCSection *textSection = getTextSection(Asm);
+        sectionAddresses[textSection] = state.address;
+
+        // Other sections are stacked downwards from the end of the data area
+        uint64_t address = state.dataEnd;
+        for (const MCSection &section : Asm) {
+            uint64_t size = Layout.getSectionAddressSize(&section);
+            if (&section == textSection || size == 0)
+                continue;
+
+            // Without a data area, nothing that refers to this section can
+            // be resolved, so it's reported as address-dependent
+            state.addressDependent = true;
+            if (!state.dataEnd)
+                continue;
+
+            uint64_t alignment = std::max(section.getAlignment(), 1U);
+            address = (address - size) & ~(alignment - 1);
+            sectionAddresses[&section] = address;
+        }
+    }
+
+    void recordRelocation(MCAssembler &Asm, const MCAsmLayout &Layout,
+                          const MCFragment *Fragment, const MCFixup &Fixup,
+                          MCValue Target, bool &IsPCRel,
+                          uint64_t &FixedValue) override
+    {
+        state.addressDependent = true;
+
+        // FixedValue is already the constant part of the target plus the
+        // offsets of its defined symbols in their sections, minus the offset
+        // of the fixup in its section if it is PC-relative, so only the
+        // section addresses (or the addresses of earlier labels) are missing
+        uint64_t value = FixedValue;
+        uint64_t address;
+        bool resolved = true;
+
+        if (const MCSymbolRefExpr *symA = Target.getSymA()) {
+            if (getSymbolBase(symA->getSymbol(), Fixup, address))
+                value += address;
+            else
+                resolved = false;
+        }
+        if (const MCSymbolRefExpr *symB = Target.getSymB()) {
+            if (getSymbolBase(symB->getSymbol(), Fixup, address))
+                value -= address;
+            else
+                resolved = false;
+        }
+        if (IsPCRel) {
+            if (getSectionAddress(Fragment->getParent(), address))
+                value -= address;
+            else
+                resolved = false;
+        }
+
+        // There's nowhere to put an unresolved relocation, so leave a hole
+        FixedValue = resolved ? value : 0;
+    }
+
+    void writeObject(MCAssembler &Asm, const MCAsmLayout &Layout) override
+    {
+        const MCSection *textSection = getTextSection(Asm);
+
+        for (const MCSymbol &symbol : Asm.symbols()) {
+            uint64_t address;
+            if (symbol.isTemporary() || !symbol.isInSection() ||
+                !getSectionAddress(&symbol.getSection(), address))
+                continue;
+            state.definedSymbols.emplace_back(
+                symbol.getName(), address + Layout.getSymbolOffset(symbol));
+            state.addressDependent = true;
+        }
+
+        // The streamer always aligns the start of the section, but any other
+        // alignment depends on where the code ends up
+        unsigned int alignments = 0;
+        for (const MCFragment &fragment : *textSection) {
+            if (fragment.getKind() == MCFragment::FT_Align)
+                ++alignments;
+        }
+        if (alignments > 1)
+            state.addressDependent = true;
+
+        // Capture the contents of the other sections separately
+        raw_pwrite_stream &textStream = getStream();
+        for (const MCSection &section : Asm) {
+            uint64_t address;
+            if (&section == textSection ||
+                !getSectionAddress(&section, address))
+                continue;
+
+            DataSection dataSection;
+            dataSection.address = address;
+            if (section.isVirtualSection()) {
+                dataSection.contents.assign(
+                    Layout.getSectionAddressSize(&section), 0);
+            } else {
+                SmallString<256> contents;
+                raw_svector_ostream contentsStream{contents};
+                setStream(contentsStream);
+                Asm.writeSectionData(&section, Layout);
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR < 8
+                contentsStream.flush();
+#endif
+                auto *buffer =
+                    reinterpret_cast<const unsigned char *>(contents.data());
+                dataSection.contents.assign(buffer, contents.size());
+            }
+            state.sections.push_back(std::move(dataSection));
+        }
+        setStream(textStream);
+
+        Asm.writeSectionData(textSection, Layout);
+    }
+};
+
+/**
+ * Backend which forwards everything to the target's backend except for
+ * creating the object writer. This is the only way to get our own object
+ * writer into the assembler.
+ */
+class CaptureAsmBackend : public MCAsmBackend {
+    std::unique_ptr<MCAsmBackend> backend;
+    bool isLittleEndian;
+    CaptureState &state;
+
+public:
+    CaptureAsmBackend(MCAsmBackend *backend, bool isLittleEndian,
+                      CaptureState &state)
+        : backend{backend}, isLittleEndian{isLittleEndian}, state(state) {}
+
+    MCObjectWriter *createObjectWriter(raw_pwrite_stream &OS) const override
+    {
+        return new CaptureObjectWriter{OS, isLittleEndian, state};
+    }
+
+    void reset() override { backend->reset(); }
+
+    unsigned getNumFixupKinds() const override
+    {
+        return backend->getNumFixupKinds();
+    }
+
+    const MCFixupKindInfo &getFixupKindInfo(MCFixupKind Kind) const override
+    {
+        return backend->getFixupKindInfo(Kind);
+    }
+
+    void processFixupValue(const MCAssembler &Asm, const MCAsmLayout &Layout,
+                           const MCFixup &Fixup, const MCFragment *DF,
+                           const MCValue &Target, uint64_t &Value,
+                           bool &IsResolved) override
+    {
+        backend->processFixupValue(Asm, Layout, Fixup, DF, Target, Value,
+                                   IsResolved);
+    }
+
+    void applyFixup(const MCFixup &Fixup, char *Data, unsigned DataSize,
+                    uint64_t Value, bool IsPCRel) const override
+    {
+        backend->applyFixup(Fixup, Data, DataSize, Value, IsPCRel);
+    }
+
+    bool mayNeedRelaxation(const MCInst &Inst) const override
+    {
+        return backend->mayNeedRelaxation(Inst);
+    }
+
+    bool fixupNeedsRelaxation(const MCFixup &Fixup, uint64_t Value,
+                              const MCRelaxableFragment *DF,
+                              const MCAsmLayout &Layout) const override
+    {
+        return backend->fixupNeedsRelaxation(Fixup, Value, DF, Layout);
+    }
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 9)
+    void relaxInstruction(const MCInst &Inst, const MCSubtargetInfo &STI,
+                          MCInst &Res) const override
+    {
+        backend->relaxInstruction(Inst, STI, Res);
+    }
+#else
+    void relaxInstruction(const MCInst &Inst, MCInst &Res) const override
+    {
+        backend->relaxInstruction(Inst, Res);
+    }
+#endif
+
+    unsigned getMinimumNopSize() const override
+    {
+        return backend->getMinimumNopSize();
+    }
+
+    bool writeNopData(uint64_t Count, MCObjectWriter *OW) const override
+    {
+        return backend->writeNopData(Count, OW);
+    }
+
+    void handleAssemblerFlag(MCAssemblerFlag Flag) override
+    {
+        backend->handleAssemblerFlag(Flag);
+    }
+};
+
+/* See CaptureStreamer.h. */
+MCStreamer *createCaptureStreamer(MCContext &context, MCAsmBackend *backend,
+                                  raw_pwrite_stream &OS,
+                                  MCCodeEmitter *codeEmitter,
+                                  bool isLittleEndian, CaptureState &state)
+{
+    auto *captureBackend =
+        new CaptureAsmBackend{backend, isLittleEndian, state};
+    return createELFStreamer(context, *captureBackend, OS, codeEmitter, true);
+}
+
+#endif
@@ -0,0 +1,707 @@
+/*
+ * Daemon which runs input for clients with a warm assembler and tracees.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "Assembler.h"
+#include "Daemon.h"
+#include "Inputter.h"
+#include "JsonWriter.h"
+#include "Session.h"
+#include "Tracee.h"
+
+/** Magic number at the start of a request. */
+static const uint32_t REQUEST_MAGIC = 0x61736d31;
+
+/** Maximum total size of the strings in a request. */
+static const uint64_t MAX_REQUEST_SIZE = 64 * 1024 * 1024;
+
+/** Number of tracees to keep forked ahead of time. */
+static const size_t SPARE_TRACEES = 2;
+
+/** Replies to a request, which are sent before the exit status. */
+enum Reply : int32_t {
+    /** The daemon is running the request, and the exit status follows. */
+    REPLY_ACCEPTED = 0,
+
+    /** The daemon can't run the request (e.g., it's for another target). */
+    REPLY_REFUSED = 1,
+};
+
+/** File descriptors which are passed with a request. */
+enum RequestFd {
+    /** The client's working directory. */
+    CWD_FD,
+
+    STDOUT_FD,
+    STDERR_FD,
+
+    NUM_REQUEST_FDS,
+};
+
+/**
+ * Fixed-size start of a request, which is sent along with the file
+ * descriptors. The version, CPU, features, script file, and commands follow
+ * with the given sizes.
+ */
+class RequestHeader {
+public:
+    uint32_t magic;
+    uint32_t jsonOutput;
+    uint32_t versionSize;
+    uint32_t cpuSize;
+    uint32_t featuresSize;
+    uint32_t scriptFileSize;
+    uint32_t commandsSize;
+};
+
+/** Control message buffer big enough for a request's file descriptors. */
+union RequestControl {
+    char buffer[CMSG_SPACE(NUM_REQUEST_FDS * sizeof(int))];
+    struct cmsghdr align;
+};
+
+/* See Daemon.h. */
+std::string getDefaultSocketPath()
+{
+    const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir)
+        return std::string{runtimeDir} + "/asmase.sock";
+    return "/tmp/asmase-" + std::to_string(getuid()) + ".sock";
+}
+
+/**
+ * Fill in the address of a socket.
+ * @return Zero on success, nonzero if the path is too long.
+ */
+static int makeAddress(const std::string &path, struct sockaddr_un &addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return 1;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return 0;
+}
+
+/**
+ * Write a whole buffer to a socket.
+ * @return Zero on success, nonzero on failure.
+ */
+static int writeAll(int sock, const void *buffer, size_t size)
+{
+    auto p = static_cast<const char *>(buffer);
+    while (size > 0) {
+        ssize_t ret = send(sock, p, size, MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        p += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+/**
+ * Read a whole buffer from a socket.
+ * @return Zero on success, nonzero on failure or EOF.
+ */
+static int readAll(int sock, void *buffer, size_t size)
+{
+    auto p = static_cast<char *>(buffer);
+    while (size > 0) {
+        ssize_t ret = recv(sock, p, size, 0);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        } else if (ret == 0)
+            return 1;
+        p += ret;
+        size -= ret;
+    }
+    return 0;
+}
+
+/** Read a string of the given size from a socket. */
+static int readString(int sock, uint32_t size, std::string &out)
+{
+    out.resize(size);
+    return size ? readAll(sock, &out[0], size) : 0;
+}
+
+/**
+ * Send the header of a request along with the file descriptors.
+ * @return Zero on success, nonzero on failure.
+ */
+static int sendHeader(int sock, const RequestHeader &header, const int *fds)
+{
+    struct iovec iov;
+    iov.iov_base = const_cast<RequestHeader *>(&header);
+    iov.iov_len = sizeof(header);
+
+    RequestControl control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(NUM_REQUEST_FDS * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, NUM_REQUEST_FDS * sizeof(int));
+
+    ssize_t ret;
+    do {
+        ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1)
+        return 1;
+
+    // The descriptors went with the first byte; the rest is sent normally
+    return writeAll(sock, reinterpret_cast<const char *>(&header) + ret,
+                    sizeof(header) - ret);
+}
+
+/**
+ * Receive the header of a request and the file descriptors sent with it.
+ * @return Zero on success, nonzero on failure, in which case no file
+ * descriptors are left open.
+ */
+static int receiveHeader(int sock, RequestHeader &header, int *fds)
+{
+    struct iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+
+    RequestControl control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t ret;
+    do {
+        ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (ret == -1 && errno == EINTR);
+    if (ret <= 0)
+        return 1;
+
+    // Take the descriptors if there are exactly the right number of them, and
+    // close anything else
+    bool gotFds = false;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        size_t numFds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        if (!gotFds && numFds == NUM_REQUEST_FDS) {
+            memcpy(fds, CMSG_DATA(cmsg), NUM_REQUEST_FDS * sizeof(int));
+            gotFds = true;
+        } else {
+            for (size_t i = 0; i < numFds; ++i) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+                close(fd);
+            }
+        }
+    }
+
+    bool ok = gotFds && !(msg.msg_flags & MSG_CTRUNC) &&
+              (static_cast<size_t>(ret) == sizeof(header) ||
+               !readAll(sock, reinterpret_cast<char *>(&header) + ret,
+                        sizeof(header) - ret));
+    if (!ok) {
+        if (gotFds) {
+            for (int i = 0; i < NUM_REQUEST_FDS; ++i)
+                close(fds[i]);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* See Daemon.h. */
+int startDaemonRequest(int sock, const DaemonRequest &request, int stdoutFd,
+                       int stderrFd)
+{
+    int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cwd == -1)
+        return 1;
+
+    std::string version = ASMASE_VERSION;
+    RequestHeader header;
+    header.magic = REQUEST_MAGIC;
+    header.jsonOutput = request.jsonOutput;
+    header.versionSize = version.size();
+    header.cpuSize = request.cpu.size();
+    header.featuresSize = request.features.size();
+    header.scriptFileSize = request.scriptFile.size();
+    header.commandsSize = request.commands.size();
+
+    int fds[NUM_REQUEST_FDS];
+    fds[CWD_FD] = cwd;
+    fds[STDOUT_FD] = stdoutFd;
+    fds[STDERR_FD] = stderrFd;
+
+    int32_t reply;
+    bool ok =
+        !sendHeader(sock, header, fds) &&
+        !writeAll(sock, version.data(), version.size()) &&
+        !writeAll(sock, request.cpu.data(), request.cpu.size()) &&
+        !writeAll(sock, request.features.data(), request.features.size()) &&
+        !writeAll(sock, request.scriptFile.data(), request.scriptFile.size()) &&
+        !writeAll(sock, request.commands.data(), request.commands.size()) &&
+        !readAll(sock, &reply, sizeof(reply)) && reply == REPLY_ACCEPTED;
+    close(cwd);
+    return ok ? 0 : 1;
+}
+
+/* See Daemon.h. */
+int finishDaemonRequest(int sock, int &statusOut)
+{
+    int32_t status;
+    if (readAll(sock, &status, sizeof(status)))
+        return 1;
+    statusOut = status;
+    return 0;
+}
+
+/* See Daemon.h. */
+int runOnDaemon(const std::string &socketPath, const DaemonRequest &request,
+                int &statusOut)
+{
+    struct sockaddr_un addr;
+    if (makeAddress(socketPath, addr))
+        return 1;
+
+    // If nobody is listening, the request quietly runs in-process
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1)
+        return 1;
+    if (connect(sock, reinterpret_cast<struct sockaddr *>(&addr),
+                sizeof(addr)) == -1) {
+        close(sock);
+        return 1;
+    }
+
+    // Nothing can be printed before the daemon writes to the same files
+    fflush(stdout);
+    fflush(stderr);
+
+    if (startDaemonRequest(sock, request, STDOUT_FILENO, STDERR_FILENO)) {
+        close(sock);
+        return 1;
+    }
+
+    // Once the request is accepted, it can't be run again in-process
+    if (finishDaemonRequest(sock, statusOut)) {
+        fprintf(stderr, "daemon failed while running input\n");
+        statusOut = 1;
+    }
+    close(sock);
+    return 0;
+}
+
+/**
+ * Read the rest of a request after its header.
+ * @return Zero on success, nonzero on failure.
+ */
+static int readRequest(int sock, const RequestHeader &header,
+                       DaemonRequest &request, std::string &version)
+{
+    uint64_t size = static_cast<uint64_t>(header.versionSize) +
+                    header.cpuSize + header.featuresSize +
+                    header.scriptFileSize + header.commandsSize;
+    if (header.magic != REQUEST_MAGIC || size > MAX_REQUEST_SIZE)
+        return 1;
+
+    request.jsonOutput = header.jsonOutput;
+    return readString(sock, header.versionSize, version) ||
+           readString(sock, header.cpuSize, request.cpu) ||
+           readString(sock, header.featuresSize, request.features) ||
+           readString(sock, header.scriptFileSize, request.scriptFile) ||
+           readString(sock, header.commandsSize, request.commands);
+}
+
+/**
+ * Listen on a socket, replacing a stale socket left behind by a daemon which
+ * is no longer running. The socket is only accessible by the current user.
+ * @return The listening socket, or -1 on error.
+ */
+static int listenOnSocket(const std::string &path)
+{
+    struct sockaddr_un addr;
+    if (makeAddress(path, addr)) {
+        fprintf(stderr, "socket path is too long: %s\n", path.c_str());
+        return -1;
+    }
+    auto sockaddr = reinterpret_cast<struct sockaddr *>(&addr);
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe != -1) {
+        bool listening = connect(probe, sockaddr, sizeof(addr)) == 0;
+        close(probe);
+        if (listening) {
+            fprintf(stderr, "a daemon is already listening on %s\n",
+                    path.c_str());
+            return -1;
+        }
+    }
+    unlink(path.c_str());
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    mode_t mask = umask(0077);
+    int ret = bind(sock, sockaddr, sizeof(addr));
+    umask(mask);
+    if (ret == -1 || listen(sock, SOMAXCONN) == -1) {
+        perror(path.c_str());
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/**
+ * State which is shared by all of the requests that a daemon runs: the
+ * assembler context and what to restore after each request.
+ */
+class DaemonState {
+public:
+    std::string cpu, features;
+    std::shared_future<std::shared_ptr<AssemblerContext>> context;
+    int cwd, stdoutFd, stderrFd;
+
+    DaemonState() : cwd{-1}, stdoutFd{-1}, stderrFd{-1} {}
+
+    ~DaemonState()
+    {
+        if (cwd != -1)
+            close(cwd);
+        if (stdoutFd != -1)
+            close(stdoutFd);
+        if (stderrFd != -1)
+            close(stderrFd);
+    }
+
+    /**
+     * Create the assembler context and save the state to restore after each
+     * request. This starts a thread, so any tracees which are forked ahead of
+     * time should be forked first.
+     * @return Zero on success, nonzero on failure.
+     */
+    int init(const std::string &cpu, const std::string &features);
+};
+
+/* See above. */
+int DaemonState::init(const std::string &cpu, const std::string &features)
+{
+    this->cpu = cpu;
+    this->features = features;
+
+    // Clients can go away at any time
+    struct sigaction act;
+    act.sa_handler = SIG_IGN;
+    act.sa_flags = 0;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGPIPE, &act, nullptr);
+
+    context = Assembler::createAssemblerContextAsync(cpu, features);
+    context.wait();
+
+    cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    stdoutFd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    stderrFd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (cwd == -1 || stdoutFd == -1 || stderrFd == -1) {
+        perror("could not save daemon state");
+        return 1;
+    }
+
+    // Output for a request is written all at once at the end
+    setvbuf(stdout, nullptr, _IOFBF, 1 << 16);
+    return 0;
+}
+
+/**
+ * Run a request with the given tracee and a fresh assembler.
+ * @return The exit status.
+ */
+static int runRequest(DaemonRequest &request, std::shared_ptr<Tracee> tracee,
+                      SpareTracees &spares, DaemonState &state)
+{
+    std::unique_ptr<Inputter> inputter{
+        createInputter(request.scriptFile, request.commands)};
+    if (!inputter)
+        return 1;
+
+    FILE *jsonFile = nullptr;
+    std::unique_ptr<JsonWriter> json;
+    if (request.jsonOutput) {
+        jsonFile = openJsonOutput();
+        if (!jsonFile)
+            return 1;
+        json.reset(new JsonWriter{jsonFile});
+    }
+
+    int status;
+    {
+        Assembler assembler{state.context};
+
+        // Like :source, this is only an optimization, so it's fine if it fails
+        if (!request.scriptFile.empty())
+            assembler.loadScript(request.scriptFile);
+
+        status = runSession(*inputter, std::move(tracee), spares, assembler,
+                            json.get());
+    }
+
+    if (jsonFile)
+        fclose(jsonFile);
+    return status;
+}
+
+/**
+ * Handle a request from a client: read it and, if it can be run, run it as
+ * the client with a tracee from the given spares and reply with its exit
+ * status.
+ * @return Zero if a request was handled (even if it was refused), nonzero if
+ * the connection was closed or broken.
+ */
+static int handleRequest(int sock, SpareTracees &spares, DaemonState &state)
+{
+    RequestHeader header;
+    int fds[NUM_REQUEST_FDS];
+    if (receiveHeader(sock, header, fds))
+        return 1;
+
+    DaemonRequest request;
+    std::string version;
+    int32_t reply = REPLY_REFUSED;
+    if (!readRequest(sock, header, request, version) &&
+        version == ASMASE_VERSION && request.cpu == state.cpu &&
+        request.features == state.features &&
+        (!request.scriptFile.empty() || !request.commands.empty()))
+        reply = REPLY_ACCEPTED;
+    if (writeAll(sock, &reply, sizeof(reply)) || reply != REPLY_ACCEPTED) {
+        for (int i = 0; i < NUM_REQUEST_FDS; ++i)
+            close(fds[i]);
+        return reply != REPLY_ACCEPTED ? 0 : 1;
+    }
+
+    std::shared_ptr<Tracee> tracee{spares.take()};
+
+    // Run as the client: in its working directory and with its output
+    fflush(stdout);
+    fflush(stderr);
+    dup2(fds[STDOUT_FD], STDOUT_FILENO);
+    dup2(fds[STDERR_FD], STDERR_FILENO);
+
+    int32_t status = 1;
+    if (fchdir(fds[CWD_FD]) == -1)
+        perror("fchdir");
+    else if (tracee)
+        status = runRequest(request, std::move(tracee), spares, state);
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(state.stdoutFd, STDOUT_FILENO);
+    dup2(state.stderrFd, STDERR_FILENO);
+    if (fchdir(state.cwd) == -1)
+        perror("fchdir");
+    for (int i = 0; i < NUM_REQUEST_FDS; ++i)
+        close(fds[i]);
+
+    return writeAll(sock, &status, sizeof(status));
+}
+
+/**
+ * Check that the peer on a connection is the same user as the daemon. The
+ * socket's permissions should already keep other users out.
+ */
+static bool isSameUser(int sock)
+{
+    struct ucred cred;
+    socklen_t credSize = sizeof(cred);
+    return getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &credSize) == 0 &&
+           cred.uid == getuid();
+}
+
+/**
+ * Serve one connection in a process forked from the daemon. The process forks
+ * its own spare tracees (a tracee can only be traced by the process which
+ * forked it), accepts a connection, tells the daemon that it did by writing to
+ * readyFd so that the daemon can get the next process ready, and then runs the
+ * request. This way, requests run concurrently, and each one still starts
+ * with a warm assembler context and a spare tracee.
+ * @return The exit status for the process.
+ */
+static int serveConnection(int listener, int readyFd, pid_t daemonPid,
+                           DaemonState &state)
+{
+    // Until it takes a connection, the process goes away with the daemon
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != daemonPid)
+        return 1;
+
+    SpareTracees spares{SPARE_TRACEES};
+    spares.fill();
+    if (!spares.size())
+        return 1;
+
+    int sock;
+    do {
+        sock = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    } while (sock == -1 && (errno == EINTR || errno == ECONNABORTED));
+    if (sock == -1) {
+        perror("accept");
+        return 1;
+    }
+    close(listener);
+    prctl(PR_SET_PDEATHSIG, 0);
+
+    char ready = 0;
+    ssize_t ret;
+    do {
+        ret = write(readyFd, &ready, 1);
+    } while (ret == -1 && errno == EINTR);
+    close(readyFd);
+
+    if (isSameUser(sock))
+        handleRequest(sock, spares, state);
+    close(sock);
+    return 0;
+}
+
+/* See Daemon.h. */
+int runDaemon(const std::string &socketPath, const std::string &cpu,
+              const std::string &features)
+{
+    DaemonState state;
+    if (state.init(cpu, features))
+        return 1;
+
+    int listener = listenOnSocket(socketPath);
+    if (listener == -1)
+        return 1;
+
+    fprintf(stderr, "asmase daemon listening on %s\n", socketPath.c_str());
+
+    // There is always one process waiting for the next connection
+    pid_t daemonPid = getpid();
+    for (;;) {
+        while (waitpid(-1, nullptr, WNOHANG) > 0)
+            ;
+
+        int ready[2];
+        if (pipe2(ready, O_CLOEXEC) == -1) {
+            perror("pipe2");
+            break;
+        }
+
+        // Don't let anything which is buffered get written twice
+        fflush(stdout);
+        fflush(stderr);
+
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            close(ready[0]);
+            close(ready[1]);
+            break;
+        } else if (pid == 0) {
+            close(ready[0]);
+            int status = serveConnection(listener, ready[1], daemonPid,
+                                         state);
+            fflush(stdout);
+            fflush(stderr);
+            _exit(status);
+        }
+        close(ready[1]);
+
+        // Wait for the process to take a connection. If it exits first, it
+        // couldn't serve one, and neither could the next one
+        char c;
+        ssize_t ret;
+        do {
+            ret = read(ready[0], &c, 1);
+        } while (ret == -1 && errno == EINTR);
+        close(ready[0]);
+        if (ret != 1) {
+            fprintf(stderr, "could not start a process to serve requests\n");
+            break;
+        }
+    }
+
+    close(listener);
+    unlink(socketPath.c_str());
+    return 1;
+}
+
+/* See Daemon.h. */
+int runDaemonWorker(int sock, const std::string &cpu,
+                    const std::string &features)
+{
+    // The spares are forked before LLVM starts any threads
+    SpareTracees spares{SPARE_TRACEES};
+    spares.fill();
+    if (!spares.size())
+        return 1;
+
+    DaemonState state;
+    if (state.init(cpu, features))
+        return 1;
+
+    while (!handleRequest(sock, spares, state))
+        spares.fill();
+    return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * Disassembler implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Disassembler.h"
+
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 7)
+
+#include <algorithm>
+#include <cassert>
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/MC/MCCodeEmitter.h>
+#include <llvm/MC/MCContext.h>
+#if LLVM_VERSION_MAJOR > 3 || (LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 8)
+#include <llvm/MC/MCDisassembler/MCDisassembler.h>
+#else
+#include <llvm/MC/MCDisassembler.h>
+#endif
+#include <llvm/MC/MCFixup.h>
+#include <llvm/MC/MCInstPrinter.h>
+#include <llvm/MC/MCInstrInfo.h>
+#include <llvm/MC/MCRegisterInfo.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/Support/raw_ostream.h>
+using namespace llvm;
+
+#include "AssemblerContext.h"
+
+/* See Disassembler.h. */
+Disassembler::Disassembler(const AssemblerContext &context)
+    : context(context)
+{
+    const Target *target = context.target;
+
+    subtargetInfo.reset(context.createSubtargetInfo());
+    assert(subtargetInfo && "Unable to create subtarget info!");
+
+    mcCtx.reset(new MCContext{context.asmInfo.get(),
+                              context.registerInfo.get(), nullptr});
+
+    disassembler.reset(target->createMCDisassembler(*subtargetInfo, *mcCtx));
+    assert(disassembler && "Unable to create disassembler!");
+
+    instPrinter.reset(target->createMCInstPrinter(
+        context.triple, context.asmInfo->getAssemblerDialect(),
+        *context.asmInfo, *context.instrInfo, *context.registerInfo));
+    assert(instPrinter && "Unable to create instruction printer!");
+}
+
+Disassembler::~Disassembler() = default;
+
+/* See Disassembler.h. */
+unsigned int Disassembler::getMaxInstructionLength() const
+{
+    return context.asmInfo->getMaxInstLength();
+}
+
+/* See Disassembler.h. */
+void Disassembler::decodeInstruction(const bytestring &machineCode,
+                                     size_t offset, uint64_t address,
+                                     DisassembledInstruction &instructionOut)
+{
+    ArrayRef<uint8_t> bytes{machineCode.data() + offset,
+                            machineCode.size() - offset};
+    uint64_t size;
+
+    instructionOut.address = address + offset;
+    MCDisassembler::DecodeStatus status = disassembler->getInstruction(
+        instructionOut.inst, size, bytes, instructionOut.address, nulls(),
+        nulls());
+    instructionOut.valid = status == MCDisassembler::Success;
+
+    // Skip a byte at a time through garbage
+    if (!instructionOut.valid || size == 0)
+        size = 1;
+    instructionOut.machineCode = machineCode.substr(offset, size);
+}
+
+/* See Disassembler.h. */
+void Disassembler::disassemble(
+    const bytestring &machineCode, uint64_t address,
+    std::vector<DisassembledInstruction> &instructionsOut)
+{
+    size_t offset = 0;
+    while (offset < machineCode.size()) {
+        DisassembledInstruction instruction;
+        decodeInstruction(machineCode, offset, address, instruction);
+        offset += instruction.machineCode.size();
+        instructionsOut.push_back(std::move(instruction));
+    }
+}
+
+/* See Disassembler.h. */
+std::string Disassembler::printInstruction(const MCInst &inst)
+{
+    std::string str;
+    raw_string_ostream stream{str};
+    instPrinter->printInst(&inst, stream, "", *subtargetInfo);
+    stream.flush();
+
+    // The printer indents with a tab
+    size_t start = str.find_first_not_of(" \t");
+    return start == std::string::npos ? std::string{} : str.substr(start);
+}
+
+/* See Disassembler.h. */
+int Disassembler::encodeInstruction(const MCInst &inst,
+                                    bytestring &machineCodeOut)
+{
+    if (!codeEmitter) {
+        codeEmitter.reset(context.target->createMCCodeEmitter(
+            *context.instrInfo, *context.registerInfo, *mcCtx));
+        assert(codeEmitter && "Unable to create code emitter!");
+    }
+
+    SmallString<32> buffer;
+    raw_svector_ostream stream{buffer};
+    SmallVector<MCFixup, 4> fixups;
+    codeEmitter->encodeInstruction(inst, stream, fixups, *subtargetInfo);
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR < 8
+    stream.flush();
+#endif
+    if (!fixups.empty())
+        return 1;
+
+    auto *bytes = reinterpret_cast<const unsigned char *>(buffer.data());
+    machineCodeOut.assign(bytes, buffer.size());
+    return 0;
+}
+
+/**
+ * Return whether the operands of an instruction fit the operands of an opcode.
+ */
+static bool operandsMatch(const MCInstrDesc &desc,
+                          const MCRegisterInfo &registerInfo,
+                          const MCInst &inst)
+{
+    if (desc.isPseudo() || desc.isVariadic() ||
+        desc.getNumOperands() != inst.getNumOperands())
+        return false;
+
+    for (unsigned int i = 0; i < inst.getNumOperands(); ++i) {
+        const MCOperandInfo &info = desc.OpInfo[i];
+        const MCOperand &operand = inst.getOperand(i);
+
+        if (info.RegClass >= 0 && !info.isLookupPtrRegClass()) {
+            if (!operand.isReg())
+                return false;
+            if (operand.getReg() &&
+                !registerInfo.getRegClass(info.RegClass)
+                     .contains(operand.getReg()))
+                return false;
+        } else if (info.OperandType == MCOI::OPERAND_REGISTER) {
+            if (!operand.isReg())
+                return false;
+        } else if (info.OperandType == MCOI::OPERAND_IMMEDIATE ||
+                   info.OperandType == MCOI::OPERAND_PCREL) {
+            if (!operand.isImm())
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/* See Disassembler.h. */
+void Disassembler::findEncodings(const MCInst &inst,
+                                 std::vector<InstructionEncoding> &encodingsOut)
+{
+    const MCInstrInfo &instrInfo = *context.instrInfo;
+    std::string text = printInstruction(inst);
+
+    for (unsigned int opcode = 0; opcode < instrInfo.getNumOpcodes();
+         ++opcode) {
+        if (!operandsMatch(instrInfo.get(opcode), *context.registerInfo,
+                           inst))
+            continue;
+
+        // Only encode opcodes that are the same instruction in the source
+        MCInst candidate{inst};
+        candidate.setOpcode(opcode);
+        if (printInstruction(candidate) != text)
+            continue;
+
+        InstructionEncoding encoding;
+        if (encodeInstruction(candidate, encoding.machineCode))
+            continue;
+
+        // Make sure that the encoding means what we think it means (e.g., an
+        // 8-bit immediate form can't encode every immediate)
+        DisassembledInstruction decoded;
+        decodeInstruction(encoding.machineCode, 0, 0, decoded);
+        if (!decoded.valid ||
+            decoded.machineCode.size() != encoding.machineCode.size() ||
+            printInstruction(decoded.inst) != text)
+            continue;
+
+        bool duplicate = false;
+        for (const InstructionEncoding &other : encodingsOut) {
+            if (other.machineCode == encoding.machineCode)
+                duplicate = true;
+        }
+        if (duplicate)
+            continue;
+
+        encoding.opcodeName = std::string(instrInfo.getName(opcode));
+        encodingsOut.push_back(std::move(encoding));
+    }
+
+    std::stable_sort(encodingsOut.begin(), encodingsOut.end(),
+                     [](const InstructionEncoding &a,
+                        const InstructionEncoding &b) {
+                         return a.machineCode.size() < b.machineCode.size();
+                     });
+}
+
+#endif
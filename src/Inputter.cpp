@@ -21,23 +21,49 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
 
 #include <readline/readline.h>
 #include <readline/history.h>
 
 #include "Inputter.h"
 
+Inputter::InputFile::InputFile(const std::string &filename, int lineno,
+                               FILE *file)
+    : filename{filename}, lineno{lineno}, file{file}, offset{0}
+{
+    // If the file can't be mapped, it's read through stdio instead. Reading
+    // starts wherever the descriptor is (e.g., if stdin was partly read by
+    // someone else first)
+    if (file && !mapping.map(fileno(file))) {
+        off_t position = lseek(fileno(file), 0, SEEK_CUR);
+        if (position > 0)
+            offset = position;
+    }
+}
+
 Inputter::Inputter()
     : lineBufferSize{0}, lineBuffer{nullptr}
 {
+    files.reserve(MAX_FILES);
     files.emplace_back("<stdin>", 0, nullptr);
     using_history();
 }
 
+Inputter::Inputter(FILE *file, const std::string &filename)
+    : lineBufferSize{0}, lineBuffer{nullptr}
+{
+    files.reserve(MAX_FILES);
+    files.emplace_back(filename, 0, file);
+}
+
 Inputter::~Inputter()
 {
     free(lineBuffer);
-    clear_history();
+    if (isInteractive())
+        clear_history();
 }
 
 /* See Inputter.h. */
@@ -59,39 +85,52 @@ int Inputter::redirectInput(const std::string &filename)
 }
 
 /* See Inputter.h. */
-std::string Inputter::readLine(const std::string &prompt)
+bool Inputter::readLine(const std::string &prompt, std::string &lineOut)
 {
-    std::string line;
-    bool gotLine = false;
-
-    do {
-        FILE *file = files.back().file;
-        ssize_t size;
-        if (file) {
-            size = getline(&lineBuffer, &lineBufferSize, file);
-            if (size == -1) {
-                if (!feof(file))
-                    perror("getline");
-                files.pop_back();
-            } else {
-                line = std::string{lineBuffer, static_cast<size_t>(size)};
-                gotLine = true;
+    for (;;) {
+        InputFile &input = files.back();
+        if (input.mapping.isMapped()) {
+            const char *data = input.mapping.data();
+            size_t size = input.mapping.size();
+            if (input.offset < size) {
+                const char *start = data + input.offset;
+                size_t remaining = size - input.offset;
+                auto newline =
+                    static_cast<const char *>(memchr(start, '\n', remaining));
+                size_t length = newline ? newline - start : remaining;
+                lineOut.assign(start, length);
+                input.offset += newline ? length + 1 : length;
+                break;
             }
-        } else { // stdin sentinel
-            char *cline;
-            if ((cline = readline(prompt.c_str()))) {
-                if (*cline) // If the line isn't empty, add it to the history
-                    add_history(cline);
-                line = cline;
-                line += '\n';
-                free(cline);
+        } else if (input.file) {
+            ssize_t size = getline(&lineBuffer, &lineBufferSize, input.file);
+            if (size != -1) {
+                if (size > 0 && lineBuffer[size - 1] == '\n')
+                    --size;
+                lineOut.assign(lineBuffer, size);
+                break;
             }
-            gotLine = true;
+            if (!feof(input.file))
+                perror("getline");
+        } else { // stdin sentinel
+            char *cline = readline(prompt.c_str());
+            if (!cline)
+                return false;
+            if (*cline) // If the line isn't empty, add it to the history
+                add_history(cline);
+            lineOut = cline;
+            free(cline);
+            break;
         }
-    } while (!gotLine);
+
+        // End of the file
+        if (files.size() == 1) // End of batch input
+            return false;
+        files.pop_back();
+    }
 
     ++files.back().lineno;
-    return line;
+    return true;
 }
 
 /* See Inputter.h. */
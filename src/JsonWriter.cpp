@@ -0,0 +1,226 @@
+/*
+ * JsonWriter implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cinttypes>
+#include <cmath>
+#include <cstring>
+
+#include "JsonWriter.h"
+#include "RegisterValue.h"
+
+void JsonWriter::separate()
+{
+    if (needsComma)
+        fputc(',', file);
+    needsComma = true;
+}
+
+void JsonWriter::writeString(const char *str, size_t size)
+{
+    fputc('"', file);
+    for (size_t i = 0; i < size; ++i) {
+        unsigned char c = str[i];
+        switch (c) {
+            case '"':
+                fputs("\\\"", file);
+                break;
+            case '\\':
+                fputs("\\\\", file);
+                break;
+            case '\n':
+                fputs("\\n", file);
+                break;
+            case '\t':
+                fputs("\\t", file);
+                break;
+            default:
+                // Bytes outside of ASCII are escaped as Latin-1 characters
+                // so that the output is always valid UTF-8
+                if (c < 0x20 || c >= 0x7f)
+                    fprintf(file, "\\u%04x", c);
+                else
+                    fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::beginObject()
+{
+    separate();
+    fputc('{', file);
+    open += '}';
+    needsComma = false;
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::endObject()
+{
+    fputc('}', file);
+    open.pop_back();
+    needsComma = true;
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::beginArray()
+{
+    separate();
+    fputc('[', file);
+    open += ']';
+    needsComma = false;
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::endArray()
+{
+    fputc(']', file);
+    open.pop_back();
+    needsComma = true;
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::key(const char *name)
+{
+    separate();
+    writeString(name, strlen(name));
+    fputc(':', file);
+    // The value goes right after the colon
+    needsComma = false;
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::stringValue(const std::string &str)
+{
+    separate();
+    writeString(str.data(), str.size());
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::stringValue(const char *str)
+{
+    separate();
+    writeString(str, strlen(str));
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::uintValue(uint64_t value)
+{
+    separate();
+    fprintf(file, "%" PRIu64, value);
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::intValue(int64_t value)
+{
+    separate();
+    fprintf(file, "%" PRId64, value);
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::doubleValue(long double value)
+{
+    if (std::isnan(value))
+        stringValue("nan");
+    else if (std::isinf(value))
+        stringValue(value < 0 ? "-inf" : "inf");
+    else {
+        separate();
+        fprintf(file, "%.21Lg", value);
+    }
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::boolValue(bool value)
+{
+    separate();
+    fputs(value ? "true" : "false", file);
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::nullValue()
+{
+    separate();
+    fputs("null", file);
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::hexValue(uint64_t value)
+{
+    separate();
+    fprintf(file, "\"0x%" PRIx64 "\"", value);
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::bytesValue(const unsigned char *bytes, size_t size)
+{
+    separate();
+    fputc('"', file);
+    for (size_t i = 0; i < size; ++i)
+        fprintf(file, "%02x", bytes[i]);
+    fputc('"', file);
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::registerValue(const RegisterValue &value)
+{
+    switch (value.type) {
+        case RegisterType::INT8:
+            hexValue(value.getInt8());
+            break;
+        case RegisterType::INT16:
+            hexValue(value.getInt16());
+            break;
+        case RegisterType::INT32:
+            hexValue(value.getInt32());
+            break;
+        case RegisterType::INT64:
+            hexValue(value.getInt64());
+            break;
+        case RegisterType::INT128: {
+            my_uint128 int128 = value.getInt128();
+            separate();
+            fprintf(file, "\"0x%016" PRIx64 "%016" PRIx64 "\"", int128.hi,
+                    int128.lo);
+            break;
+        }
+        case RegisterType::FLOAT:
+            doubleValue(value.getFloat());
+            break;
+        case RegisterType::DOUBLE:
+            doubleValue(value.getDouble());
+            break;
+        case RegisterType::LONG_DOUBLE:
+            doubleValue(value.getLongDouble());
+            break;
+    }
+}
+
+/* See JsonWriter.h. */
+void JsonWriter::endRecord()
+{
+    while (!open.empty()) {
+        fputc(open.back(), file);
+        open.pop_back();
+    }
+    fputc('\n', file);
+    needsComma = false;
+}
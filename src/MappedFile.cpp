@@ -0,0 +1,53 @@
+/*
+ * MappedFile implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "MappedFile.h"
+
+MappedFile::~MappedFile()
+{
+    if (address)
+        munmap(const_cast<char *>(address), length);
+}
+
+/* See MappedFile.h. */
+int MappedFile::map(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        return 1;
+
+    size_t size = st.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+        return 1;
+
+    // Files are read front to back, so let the kernel read ahead aggressively
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    if (address)
+        munmap(const_cast<char *>(address), length);
+    address = static_cast<const char *>(mapping);
+    length = size;
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * PerfCounters implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include "PerfCounters.h"
+
+/**
+ * Open a user-space hardware counter for a process.
+ * @return The file descriptor, or -1 on failure.
+ */
+static int openCounter(pid_t pid, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    // glibc doesn't provide a wrapper
+    return syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+/* See PerfCounters.h. */
+PerfCounters::~PerfCounters()
+{
+    if (cyclesFd != -1)
+        close(cyclesFd);
+    if (instructionsFd != -1)
+        close(instructionsFd);
+}
+
+/* See PerfCounters.h. */
+int PerfCounters::open(pid_t pid)
+{
+    int cycles = openCounter(pid, PERF_COUNT_HW_CPU_CYCLES);
+    if (cycles == -1)
+        return 1;
+
+    int instructions = openCounter(pid, PERF_COUNT_HW_INSTRUCTIONS);
+    if (instructions == -1) {
+        close(cycles);
+        return 1;
+    }
+
+    cyclesFd = cycles;
+    instructionsFd = instructions;
+    return 0;
+}
+
+/** Read the value of a counter. */
+static bool readCounter(int fd, uint64_t &value)
+{
+    return ::read(fd, &value, sizeof(value)) == sizeof(value);
+}
+
+/* See PerfCounters.h. */
+int PerfCounters::read(uint64_t &cycles, uint64_t &instructions) const
+{
+    if (!isOpen() || !readCounter(cyclesFd, cycles) ||
+        !readCounter(instructionsFd, instructions))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,434 @@
+/*
+ * Pool of worker processes which run many scripts concurrently.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "Daemon.h"
+#include "Pool.h"
+
+/** Maximum number of events to handle per epoll_wait(). */
+static const int MAX_EVENTS = 64;
+
+/** A worker process and the script it is running, if any. */
+class Worker {
+public:
+    pid_t pid;
+
+    /** Our end of the socket pair that the worker serves, or -1 if dead. */
+    int sock;
+
+    /** Whether the worker is running a script. */
+    bool busy;
+
+    /** Index of the script the worker is running. */
+    size_t script;
+};
+
+/** Collected output and exit status of a script. */
+class ScriptResult {
+public:
+    /** Temporary files which the script's stdout and stderr go to. */
+    FILE *out, *err;
+
+    /** Error to report after the output if the script couldn't be run. */
+    std::string error;
+
+    int status;
+    bool done;
+
+    ScriptResult() : out{nullptr}, err{nullptr}, status{0}, done{false} {}
+};
+
+/**
+ * Expand directories in a list of paths into the regular files in them, in
+ * order by name. Hidden files are skipped.
+ * @return Zero on success, nonzero on failure.
+ */
+static int expandPaths(const std::vector<std::string> &paths,
+                       std::vector<std::string> &scriptsOut)
+{
+    for (const std::string &path : paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st) == -1) {
+            perror(path.c_str());
+            return 1;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            scriptsOut.push_back(path);
+            continue;
+        }
+
+        DIR *dir = opendir(path.c_str());
+        if (!dir) {
+            perror(path.c_str());
+            return 1;
+        }
+
+        std::vector<std::string> entries;
+        while (struct dirent *entry = readdir(dir)) {
+            if (entry->d_name[0] == '.')
+                continue;
+            std::string entryPath = path + '/' + entry->d_name;
+            if (stat(entryPath.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                entries.push_back(std::move(entryPath));
+        }
+        closedir(dir);
+
+        std::sort(entries.begin(), entries.end());
+        scriptsOut.insert(scriptsOut.end(), entries.begin(), entries.end());
+    }
+    return 0;
+}
+
+/** Copy a temporary output file to a stream and close it. */
+static void copyOutput(FILE *from, FILE *to)
+{
+    // The worker wrote through its own descriptor, which shares our offset
+    rewind(from);
+
+    char buffer[1 << 16];
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), from)) > 0)
+        fwrite(buffer, 1, size, to);
+    fclose(from);
+}
+
+/**
+ * State of a run: the scripts, the workers, and the results which haven't
+ * been written out yet.
+ */
+class Pool {
+    const std::vector<std::string> &scripts;
+    std::vector<Worker> workers;
+    std::vector<ScriptResult> results;
+
+    /** Template for requests; only the script changes. */
+    DaemonRequest request;
+
+    int epfd;
+
+    /** Index of the next script to hand out. */
+    size_t next;
+
+    /** Index of the next script to write the output of. */
+    size_t printed;
+
+    /** Number of busy workers. */
+    size_t running;
+
+    int exitStatus;
+
+    /** Mark a script as finished. */
+    void finish(size_t index, int status)
+    {
+        results[index].status = status;
+        results[index].done = true;
+    }
+
+    /** Close the connection to a dead or misbehaving worker. */
+    void retire(Worker &worker)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, worker.sock, nullptr);
+        close(worker.sock);
+        worker.sock = -1;
+    }
+
+    /** Give the next script to an idle worker, if there is one. */
+    void dispatch(Worker &worker);
+
+    /** Handle a worker which finished a script or went away. */
+    void handleEvent(Worker &worker);
+
+    /**
+     * Write out the output of the finished scripts which aren't waiting on
+     * an earlier script.
+     */
+    void printFinished();
+
+public:
+    Pool(const std::vector<std::string> &scripts, const std::string &cpu,
+         const std::string &features, bool jsonOutput)
+        : scripts(scripts), results(scripts.size()), epfd{-1}, next{0},
+          printed{0}, running{0}, exitStatus{0}
+    {
+        request.cpu = cpu;
+        request.features = features;
+        request.jsonOutput = jsonOutput;
+    }
+
+    ~Pool();
+
+    /**
+     * Fork the workers. This must be done before anything else in this
+     * process starts a thread.
+     * @return Zero on success, nonzero if no workers could be started.
+     */
+    int startWorkers(size_t jobs);
+
+    /**
+     * Run all of the scripts and write out their output.
+     * @return The exit status.
+     */
+    int run();
+};
+
+/* See above. */
+Pool::~Pool()
+{
+    // Closing the socket is how a worker is told to exit
+    for (Worker &worker : workers) {
+        if (worker.sock != -1)
+            close(worker.sock);
+    }
+    for (Worker &worker : workers) {
+        while (waitpid(worker.pid, nullptr, 0) == -1 && errno == EINTR)
+            ;
+    }
+    for (ScriptResult &result : results) {
+        if (result.out)
+            fclose(result.out);
+        if (result.err)
+            fclose(result.err);
+    }
+    if (epfd != -1)
+        close(epfd);
+}
+
+/* See above. */
+int Pool::startWorkers(size_t jobs)
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        perror("epoll_create1");
+        return 1;
+    }
+
+    workers.reserve(jobs);
+    for (size_t i = 0; i < jobs; ++i) {
+        int socks[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, socks) == -1) {
+            perror("socketpair");
+            break;
+        }
+
+        // Don't let anything which is buffered get written twice
+        fflush(stdout);
+        fflush(stderr);
+
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            close(socks[0]);
+            close(socks[1]);
+            break;
+        } else if (pid == 0) {
+            close(socks[0]);
+            for (Worker &worker : workers)
+                close(worker.sock);
+            int status = runDaemonWorker(socks[1], request.cpu,
+                                         request.features);
+            fflush(stdout);
+            fflush(stderr);
+            _exit(status);
+        }
+        close(socks[1]);
+
+        Worker worker;
+        worker.pid = pid;
+        worker.sock = socks[0];
+        worker.busy = false;
+        worker.script = 0;
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = workers.size();
+        workers.push_back(worker);
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, worker.sock, &event) == -1) {
+            perror("epoll_ctl");
+            retire(workers.back());
+        }
+    }
+
+    for (Worker &worker : workers) {
+        if (worker.sock != -1)
+            return 0;
+    }
+    return 1;
+}
+
+/* See above. */
+void Pool::dispatch(Worker &worker)
+{
+    while (next < scripts.size()) {
+        ScriptResult &result = results[next];
+        result.out = tmpfile();
+        result.err = tmpfile();
+        if (!result.out || !result.err) {
+            result.error = std::string{"tmpfile: "} + strerror(errno);
+            if (result.out)
+                fclose(result.out);
+            if (result.err)
+                fclose(result.err);
+            result.out = result.err = nullptr;
+            finish(next++, 1);
+            continue;
+        }
+
+        request.scriptFile = scripts[next];
+        if (startDaemonRequest(worker.sock, request, fileno(result.out),
+                               fileno(result.err))) {
+            // Leave the script for another worker
+            fclose(result.out);
+            fclose(result.err);
+            result.out = result.err = nullptr;
+            retire(worker);
+            return;
+        }
+
+        worker.busy = true;
+        worker.script = next++;
+        ++running;
+        return;
+    }
+}
+
+/* See above. */
+void Pool::handleEvent(Worker &worker)
+{
+    if (!worker.busy) {
+        // An idle worker only becomes readable if it died
+        retire(worker);
+        return;
+    }
+
+    worker.busy = false;
+    --running;
+
+    int status;
+    if (finishDaemonRequest(worker.sock, status)) {
+        results[worker.script].error = "worker exited while running script";
+        finish(worker.script, 1);
+        retire(worker);
+        return;
+    }
+    finish(worker.script, status);
+    dispatch(worker);
+}
+
+/* See above. */
+void Pool::printFinished()
+{
+    for (; printed < scripts.size() && results[printed].done; ++printed) {
+        ScriptResult &result = results[printed];
+        if (result.out) {
+            copyOutput(result.out, stdout);
+            result.out = nullptr;
+        }
+        fflush(stdout);
+        if (result.err) {
+            copyOutput(result.err, stderr);
+            result.err = nullptr;
+        }
+        if (!result.error.empty()) {
+            fprintf(stderr, "%s: %s\n", scripts[printed].c_str(),
+                    result.error.c_str());
+        }
+        fflush(stderr);
+
+        if (result.status)
+            exitStatus = 1;
+    }
+}
+
+/* See above. */
+int Pool::run()
+{
+    for (Worker &worker : workers) {
+        if (worker.sock != -1)
+            dispatch(worker);
+    }
+
+    for (;;) {
+        printFinished();
+        if (printed == scripts.size())
+            break;
+
+        if (running == 0) {
+            // Every worker is gone, so there's nothing left to run the rest
+            for (; next < scripts.size(); ++next) {
+                results[next].error = "no worker left to run script";
+                finish(next, 1);
+            }
+            continue;
+        }
+
+        struct epoll_event events[MAX_EVENTS];
+        int numEvents = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (numEvents == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return 1;
+        }
+        for (int i = 0; i < numEvents; ++i) {
+            Worker &worker = workers[events[i].data.u32];
+            if (worker.sock != -1)
+                handleEvent(worker);
+        }
+    }
+
+    return exitStatus;
+}
+
+/* See Pool.h. */
+int runScripts(const std::vector<std::string> &paths, unsigned int jobs,
+               const std::string &cpu, const std::string &features,
+               bool jsonOutput)
+{
+    std::vector<std::string> scripts;
+    if (expandPaths(paths, scripts))
+        return 1;
+    if (scripts.empty())
+        return 0;
+
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? cpus : 1;
+    }
+
+    Pool pool{scripts, cpu, features, jsonOutput};
+    if (pool.startWorkers(std::min<size_t>(jobs, scripts.size())))
+        return 1;
+    return pool.run();
+}
@@ -0,0 +1,382 @@
+/*
+ * Prelude implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <cstdio>
+
+#include "Prelude.h"
+#include "ScriptCache.h"
+
+/* See Prelude.h. */
+Prelude::Prelude(const std::string &commentString,
+                 const std::string &separatorString)
+    : commentString{commentString}, separatorString{separatorString},
+      lineCount{0}, hash{ScriptCache::HASH_SEED} {}
+
+/** Trim leading and trailing whitespace from a string. */
+static std::string trim(const std::string &str)
+{
+    size_t start = 0, end = str.size();
+    while (start < end && isspace(str[start]))
+        ++start;
+    while (end > start && isspace(str[end - 1]))
+        --end;
+    return str.substr(start, end - start);
+}
+
+/** Return whether the source has the given (non-empty) string at pos. */
+static inline bool hasAt(const std::string &source, size_t pos,
+                         const std::string &str)
+{
+    return !str.empty() && source.compare(pos, str.size(), str) == 0;
+}
+
+/* See above. */
+std::vector<std::string>
+Prelude::splitStatements(const std::string &source) const
+{
+    std::vector<std::string> statements;
+    std::string statement;
+
+    for (size_t i = 0; i <= source.size(); ++i) {
+        bool end = i == source.size() || source[i] == '\n';
+
+        if (!end && hasAt(source, i, commentString)) {
+            // Skip to the end of the line
+            i = source.find('\n', i);
+            if (i == std::string::npos)
+                i = source.size();
+            end = true;
+        } else if (!end && hasAt(source, i, separatorString)) {
+            i += separatorString.size() - 1;
+            end = true;
+        }
+
+        if (end) {
+            statement = trim(statement);
+            if (!statement.empty())
+                statements.push_back(std::move(statement));
+            statement.clear();
+            continue;
+        }
+
+        char c = source[i];
+        statement += c;
+        if (c == '"') {
+            // Copy the rest of the string literal verbatim
+            while (++i < source.size()) {
+                statement += source[i];
+                if (source[i] == '\\' && i + 1 < source.size())
+                    statement += source[++i];
+                else if (source[i] == '"')
+                    break;
+            }
+        } else if (c == '\'' && i + 1 < source.size()) {
+            // Character literal
+            statement += source[++i];
+            if (source[i] == '\\' && i + 1 < source.size())
+                statement += source[++i];
+        }
+    }
+
+    return statements;
+}
+
+/** Return whether a character can start a symbol name. */
+static inline bool isSymbolStart(char c)
+{
+    return isalpha(c) || c == '_' || c == '.' || c == '$';
+}
+
+/** Return whether a character can be part of a symbol name. */
+static inline bool isSymbolChar(char c)
+{
+    return isalnum(c) || c == '_' || c == '.' || c == '$';
+}
+
+/**
+ * Get the position of a statement after any labels and the statement's first
+ * word (i.e., the directive or mnemonic) in lowercase.
+ */
+static size_t skipLabels(const std::string &statement, std::string &wordOut)
+{
+    size_t pos = 0;
+
+    for (;;) {
+        size_t end = pos;
+        if (end < statement.size() && isSymbolStart(statement[end])) {
+            while (end < statement.size() && isSymbolChar(statement[end]))
+                ++end;
+        }
+
+        if (end > pos && end < statement.size() && statement[end] == ':') {
+            pos = end + 1;
+            while (pos < statement.size() && isspace(statement[pos]))
+                ++pos;
+            continue;
+        }
+
+        wordOut.clear();
+        for (size_t i = pos; i < end; ++i)
+            wordOut += tolower(statement[i]);
+        return pos;
+    }
+}
+
+/**
+ * Return whether a statement is an assignment (e.g., x = 1). In a .irp body or
+ * a macro, the name may be built from arguments (e.g., \name\()_size = 8).
+ */
+static bool isAssignment(const std::string &statement, size_t pos)
+{
+    if (pos >= statement.size() ||
+        !(isSymbolStart(statement[pos]) || statement[pos] == '\\'))
+        return false;
+    while (pos < statement.size() &&
+           (isSymbolChar(statement[pos]) || statement[pos] == '\\' ||
+            statement[pos] == '(' || statement[pos] == ')'))
+        ++pos;
+    while (pos < statement.size() && isspace(statement[pos]))
+        ++pos;
+    return pos < statement.size() && statement[pos] == '=' &&
+           (pos + 1 == statement.size() || statement[pos + 1] != '=');
+}
+
+/** Return whether a directive defines something for later statements. */
+static bool isDefinition(const std::string &directive)
+{
+    return directive == ".set" || directive == ".equ" ||
+           directive == ".equiv" || directive == ".eqv" ||
+           directive == ".purgem" || directive == ".altmacro" ||
+           directive == ".noaltmacro";
+}
+
+/** Return whether a directive starts a multi-line construct. */
+static bool isOpener(const std::string &directive)
+{
+    return directive == ".macro" || directive == ".rept" ||
+           directive == ".irp" || directive == ".irpc" ||
+           directive.compare(0, 3, ".if") == 0;
+}
+
+/** Return whether a directive ends a multi-line construct. */
+static bool isCloser(const std::string &directive)
+{
+    return directive == ".endm" || directive == ".endmacro" ||
+           directive == ".endr" || directive == ".endif";
+}
+
+/**
+ * Get the name of the symbol assigned by a definition at pos in a statement,
+ * or an empty string if it isn't a plain assignment of a symbol (e.g., it's a
+ * .eqv, which is evaluated lazily, or the name is built from macro arguments).
+ */
+static std::string getAssignedSymbol(const std::string &statement, size_t pos,
+                                     const std::string &directive)
+{
+    if (directive == ".set" || directive == ".equ" || directive == ".equiv") {
+        pos += directive.size();
+        while (pos < statement.size() && isspace(statement[pos]))
+            ++pos;
+    } else if (!isAssignment(statement, pos)) {
+        return "";
+    }
+
+    size_t end = pos;
+    if (end < statement.size() && isSymbolStart(statement[end])) {
+        while (end < statement.size() && isSymbolChar(statement[end]))
+            ++end;
+    }
+    size_t after = end;
+    while (after < statement.size() && isspace(statement[after]))
+        ++after;
+    if (end == pos || after == statement.size() ||
+        (statement[after] != ',' && statement[after] != '='))
+        return "";
+    return statement.substr(pos, end - pos);
+}
+
+/* See Prelude.h. */
+bool Prelude::add(const std::string &newSource)
+{
+    std::string added, block;
+    std::vector<std::string> assigned;
+    bool collapsible = true, blockDefines = false;
+    int depth = 0, macroDepth = 0;
+
+    lastAssigned.clear();
+
+    for (const std::string &statement : splitStatements(newSource)) {
+        std::string directive;
+        size_t pos = skipLabels(statement, directive);
+        std::string &out = depth > 0 ? block : added;
+
+        // Macro bodies are copied as is
+        if (directive == ".macro")
+            ++macroDepth;
+        if (macroDepth > 0) {
+            out += statement;
+            out += '\n';
+            if (directive == ".endm" || directive == ".endmacro")
+                --macroDepth;
+            blockDefines = true;
+            collapsible = false;
+            continue;
+        }
+
+        // Conditional and repeated blocks are kept whole with only the
+        // statements which define something, since running them once at the
+        // top level wouldn't do the same thing. Labels in front of
+        // definitions are dropped so that they aren't defined again.
+        bool definition = isDefinition(directive) ||
+                          isAssignment(statement, pos);
+        if (isOpener(directive)) {
+            if (depth++ == 0) {
+                block.clear();
+                blockDefines = false;
+            }
+            block += statement.substr(pos);
+            block += '\n';
+        } else if (depth > 0 && (isCloser(directive) ||
+                                 directive.compare(0, 5, ".else") == 0)) {
+            block += statement.substr(pos);
+            block += '\n';
+            if (isCloser(directive) && --depth == 0 && blockDefines)
+                added += block;
+        } else if (definition) {
+            out += statement.substr(pos);
+            out += '\n';
+            if (depth > 0)
+                blockDefines = true;
+
+            std::string symbol = getAssignedSymbol(statement, pos, directive);
+            if (symbol.empty())
+                collapsible = false;
+            else if (std::find(assigned.begin(), assigned.end(), symbol) ==
+                     assigned.end())
+                assigned.push_back(std::move(symbol));
+        }
+    }
+
+    if (added.empty())
+        return false;
+
+    source += added;
+    lineCount += std::count(added.begin(), added.end(), '\n');
+    hash = ScriptCache::hash(added, hash);
+    entries.push_back(Entry{std::move(added), ""});
+    if (collapsible)
+        lastAssigned = std::move(assigned);
+    return true;
+}
+
+/** Return whether source mentions a symbol by name. */
+static bool mentions(const std::string &source, const std::string &symbol)
+{
+    // A name might be built from macro arguments, so assume it's there
+    if (source.find('\\') != std::string::npos)
+        return true;
+
+    for (size_t i = 0; i < source.size();) {
+        if (!isSymbolStart(source[i])) {
+            ++i;
+            continue;
+        }
+        size_t end = i;
+        while (end < source.size() && isSymbolChar(source[end]))
+            ++end;
+        if (source.compare(i, end - i, symbol) == 0)
+            return true;
+        i = end;
+    }
+    return false;
+}
+
+/* See Prelude.h. */
+void Prelude::collapseLast(
+    const std::vector<std::pair<std::string, int64_t>> &constants)
+{
+    if (lastAssigned.empty())
+        return;
+    lastAssigned.clear();
+    entries.pop_back();
+
+    for (auto &constant : constants) {
+        for (size_t i = entries.size(); i-- > 0;) {
+            const Entry &entry = entries[i];
+            if (entry.symbol == constant.first) {
+                entries.erase(entries.begin() + i);
+                break;
+            }
+            if (entry.symbol.empty() && mentions(entry.source, constant.first))
+                break;
+        }
+
+        char value[32];
+        snprintf(value, sizeof(value), "0x%" PRIx64,
+                 static_cast<uint64_t>(constant.second));
+        entries.push_back(
+            Entry{constant.first + " = " + value + "\n", constant.first});
+    }
+
+    rebuildSource();
+}
+
+/* See Prelude.h. */
+void Prelude::rebuildSource()
+{
+    source.clear();
+    lineCount = 0;
+    for (const Entry &entry : entries) {
+        source += entry.source;
+        lineCount += std::count(entry.source.begin(), entry.source.end(), '\n');
+    }
+}
+
+/* See Prelude.h. */
+void Prelude::clear()
+{
+    entries.clear();
+    source.clear();
+    lineCount = 0;
+    hash = ScriptCache::HASH_SEED;
+    lastAssigned.clear();
+}
+
+/* See Prelude.h. */
+int Prelude::getNesting(const std::string &source) const
+{
+    int nesting = 0;
+
+    for (const std::string &statement : splitStatements(source)) {
+        std::string directive;
+        skipLabels(statement, directive);
+
+        if (isOpener(directive))
+            ++nesting;
+        else if (isCloser(directive))
+            --nesting;
+    }
+
+    return nesting;
+}
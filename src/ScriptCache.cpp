@@ -0,0 +1,213 @@
+/*
+ * ScriptCache implementation.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ScriptCache.h"
+
+/** Magic number at the start of a cache file. */
+static const char CACHE_MAGIC[8] = {'a', 's', 'm', 'a', 's', 'e', 'S', '1'};
+
+/* See ScriptCache.h. */
+uint64_t ScriptCache::hash(const void *buffer, size_t size, uint64_t seed)
+{
+    auto p = static_cast<const unsigned char *>(buffer);
+    uint64_t h = seed;
+    for (size_t i = 0; i < size; ++i) {
+        h ^= p[i];
+        h *= UINT64_C(0x100000001b3);
+    }
+    return h;
+}
+
+/**
+ * Create a directory if it doesn't already exist.
+ * @return Zero on success, nonzero on failure.
+ */
+static int makeDirectory(const std::string &path)
+{
+    if (mkdir(path.c_str(), 0700) == -1 && errno != EEXIST)
+        return 1;
+    return 0;
+}
+
+/* See ScriptCache.h. */
+std::string ScriptCache::getCachePath(const std::string &filename)
+{
+    std::string dir;
+    const char *cacheHome = getenv("XDG_CACHE_HOME");
+    if (cacheHome && *cacheHome)
+        dir = cacheHome;
+    else {
+        const char *home = getenv("HOME");
+        if (!home || !*home)
+            return {};
+        dir = home;
+        dir += "/.cache";
+    }
+
+    if (makeDirectory(dir))
+        return {};
+    dir += "/asmase";
+    if (makeDirectory(dir))
+        return {};
+
+    // Name the cache after the absolute path of the script so that scripts
+    // with the same name in different directories don't collide
+    char absolutePath[PATH_MAX];
+    if (!realpath(filename.c_str(), absolutePath))
+        return {};
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016" PRIx64 ".cache",
+             hash(absolutePath, strlen(absolutePath)));
+    return dir + name;
+}
+
+/* See ScriptCache.h. */
+void ScriptCache::add(int lineno, const std::string &text,
+                      uint64_t preludeHash, const bytestring &machineCode)
+{
+    entries[lineno] = Entry{hash(text, preludeHash), machineCode};
+}
+
+/* See ScriptCache.h. */
+const bytestring *ScriptCache::lookup(int lineno, const std::string &text,
+                                      uint64_t preludeHash) const
+{
+    auto it = entries.find(lineno);
+    if (it == entries.end() ||
+        it->second.textHash != hash(text, preludeHash))
+        return nullptr;
+    return &it->second.machineCode;
+}
+
+/** Read a value from a cache file. */
+template <typename T>
+static inline bool readValue(FILE *file, T &value)
+{
+    return fread(&value, sizeof(value), 1, file) == 1;
+}
+
+/** Write a value to a cache file. */
+template <typename T>
+static inline bool writeValue(FILE *file, const T &value)
+{
+    return fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+/* See ScriptCache.h. */
+int ScriptCache::load(const std::string &path, uint64_t key)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return 1;
+
+    // Sizes in the file are checked against its length, so a truncated or
+    // corrupt cache is treated as stale instead of being trusted
+    struct stat st;
+    if (fstat(fileno(file), &st) == -1) {
+        fclose(file);
+        return 1;
+    }
+
+    char magic[sizeof(CACHE_MAGIC)];
+    uint64_t fileKey;
+    uint32_t count;
+    bool ok = fread(magic, sizeof(magic), 1, file) == 1 &&
+              memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0 &&
+              readValue(file, fileKey) && fileKey == key &&
+              readValue(file, count);
+
+    std::unordered_map<int, Entry> loaded;
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        int32_t lineno;
+        uint32_t size;
+        Entry entry;
+
+        ok = readValue(file, lineno) && readValue(file, entry.textHash) &&
+             readValue(file, size);
+        if (!ok)
+            break;
+
+        long offset = ftell(file);
+        if (offset == -1 || size > st.st_size - offset) {
+            ok = false;
+            break;
+        }
+
+        entry.machineCode.resize(size);
+        if (size)
+            ok = fread(&entry.machineCode[0], size, 1, file) == 1;
+        loaded[lineno] = std::move(entry);
+    }
+
+    fclose(file);
+    if (!ok)
+        return 1;
+
+    entries = std::move(loaded);
+    return 0;
+}
+
+/* See ScriptCache.h. */
+int ScriptCache::save(const std::string &path, uint64_t key) const
+{
+    // Write to a temporary file and rename it so that a concurrent run never
+    // sees a partial cache
+    std::string tmpPath = path + ".tmp" + std::to_string(getpid());
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (!file)
+        return 1;
+
+    bool ok = fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, file) == 1 &&
+              writeValue(file, key) &&
+              writeValue(file, static_cast<uint32_t>(entries.size()));
+    for (auto &entry : entries) {
+        if (!ok)
+            break;
+
+        const bytestring &machineCode = entry.second.machineCode;
+        ok = writeValue(file, static_cast<int32_t>(entry.first)) &&
+             writeValue(file, entry.second.textHash) &&
+             writeValue(file, static_cast<uint32_t>(machineCode.size())) &&
+             (machineCode.empty() ||
+              fwrite(machineCode.data(), machineCode.size(), 1, file) == 1);
+    }
+
+    if (fclose(file) == EOF)
+        ok = false;
+    if (ok && rename(tmpPath.c_str(), path.c_str()) == -1)
+        ok = false;
+    if (!ok) {
+        unlink(tmpPath.c_str());
+        return 1;
+    }
+
+    return 0;
+}
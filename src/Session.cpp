@@ -0,0 +1,362 @@
+/*
+ * Running a session of input.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Assembler.h"
+#include "Builtins.h"
+#include "Inputter.h"
+#include "JsonWriter.h"
+#include "RegisterCategory.h"
+#include "RegisterDesc.h"
+#include "Session.h"
+#include "Support.h"
+#include "Tracee.h"
+
+typedef std::vector<std::pair<const RegisterDesc *,
+                              std::shared_ptr<RegisterValue>>> RegisterValues;
+
+/**
+ * Registers which are compared before and after running code for JSON output.
+ * The program counter always changes, so it isn't interesting.
+ */
+static const RegisterCategory CHANGED_REGISTER_CATEGORIES =
+    RegisterCategory::GENERAL_PURPOSE | RegisterCategory::CONDITION_CODE |
+    RegisterCategory::SEGMENTATION | RegisterCategory::FLOATING_POINT |
+    RegisterCategory::EXTRA;
+
+/** Return whether two values of the same register are the same. */
+static bool sameRegisterValue(const RegisterValue &a, const RegisterValue &b)
+{
+    switch (a.type) {
+        case RegisterType::INT8:
+            return a.getInt8() == b.getInt8();
+        case RegisterType::INT16:
+            return a.getInt16() == b.getInt16();
+        case RegisterType::INT32:
+            return a.getInt32() == b.getInt32();
+        case RegisterType::INT64:
+            return a.getInt64() == b.getInt64();
+        case RegisterType::INT128:
+            return a.getInt128().lo == b.getInt128().lo &&
+                   a.getInt128().hi == b.getInt128().hi;
+        // A NaN which stays a NaN isn't a change
+        case RegisterType::FLOAT:
+            return a.getFloat() == b.getFloat() ||
+                   (a.getFloat() != a.getFloat() &&
+                    b.getFloat() != b.getFloat());
+        case RegisterType::DOUBLE:
+            return a.getDouble() == b.getDouble() ||
+                   (a.getDouble() != a.getDouble() &&
+                    b.getDouble() != b.getDouble());
+        case RegisterType::LONG_DOUBLE:
+            return a.getLongDouble() == b.getLongDouble() ||
+                   (a.getLongDouble() != a.getLongDouble() &&
+                    b.getLongDouble() != b.getLongDouble());
+    }
+    return false;
+}
+
+/** Write how a run of code went as members of the open JSON object. */
+static void writeCodeRun(JsonWriter &json, Tracee &tracee, const CodeRun &run,
+                         const RegisterValues &before)
+{
+    static const char *stopNames[] = {
+        "trap", "signal", "exited", "terminated", "error",
+    };
+
+    json.key("stop");
+    json.stringValue(stopNames[static_cast<int>(run.stop)]);
+    switch (run.stop) {
+        case CodeRun::Stop::SIGNAL:
+        case CodeRun::Stop::TERMINATED:
+            json.key("signal");
+            json.stringValue(strsignal(run.stopStatus));
+            break;
+        case CodeRun::Stop::EXITED:
+            json.key("exit_status");
+            json.intValue(run.stopStatus);
+            break;
+        default:
+            break;
+    }
+
+    json.key("nanoseconds");
+    json.uintValue(run.nanoseconds);
+    if (run.measured) {
+        json.key("cycles");
+        json.uintValue(run.cycles);
+        json.key("instructions");
+        json.uintValue(run.instructions);
+    }
+
+    // The registers can't be read if the tracee died
+    RegisterValues after;
+    if (before.empty() ||
+        tracee.getRegisterValues(CHANGED_REGISTER_CATEGORIES, after) ||
+        after.size() != before.size())
+        return;
+
+    json.key("changed_registers");
+    json.beginObject();
+    for (size_t i = 0; i < after.size(); ++i) {
+        if (!sameRegisterValue(*before[i].second, *after[i].second)) {
+            json.key(after[i].first->name.c_str());
+            json.registerValue(*after[i].second);
+        }
+    }
+    json.endObject();
+}
+
+/**
+ * Load assembled code and its data into the tracee, print it, and run it. If
+ * json is given, the code and how it ran are written to the open JSON object
+ * instead of printing the code.
+ * @return Zero on success, positive on error, negative on fatal error.
+ */
+static int runMachineCode(Tracee &tracee, const std::string &source,
+                   const bytestring &machineCode,
+                   const std::vector<DataSection> &sections,
+                   JsonWriter *json = nullptr)
+{
+    if (tracee.placeData(sections))
+        return 1;
+    if (machineCode.empty())
+        return 0;
+
+    if (!json) {
+        printf("%s = ", source.c_str());
+        tracee.printInstruction(machineCode);
+        printf("\n");
+        return tracee.executeCode(machineCode);
+    }
+
+    uint64_t address = reinterpret_cast<uintptr_t>(tracee.getCodeAddress());
+    json->key("address");
+    json->hexValue(address);
+    json->key("machine_code");
+    json->bytesValue(machineCode.data(), machineCode.size());
+
+    RegisterValues before;
+    tracee.getRegisterValues(CHANGED_REGISTER_CATEGORIES, before);
+
+    int error = tracee.executeCode(machineCode);
+
+    // If the code didn't fit, it never ran
+    const CodeRun &run = tracee.getLastRun();
+    if (run.address == address)
+        writeCodeRun(*json, tracee, run, before);
+    return error;
+}
+
+/** Start the JSON record for a line of input. */
+static void beginRecord(JsonWriter *json, const char *type,
+                        const std::string &source)
+{
+    if (!json)
+        return;
+    json->beginObject();
+    json->key("type");
+    json->stringValue(type);
+    json->key("source");
+    json->stringValue(source);
+}
+
+/** Finish the JSON record for a line of input with its result. */
+static void endRecord(JsonWriter *json, int error)
+{
+    if (!json)
+        return;
+    json->key("status");
+    json->stringValue(error == 0 ? "ok" : error > 0 ? "error" : "fatal");
+    json->endRecord();
+}
+
+/* See Session.h. */
+FILE *openJsonOutput()
+{
+    int fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("fcntl");
+        return nullptr;
+    }
+
+    FILE *file = fdopen(fd, "w");
+    if (!file) {
+        perror("fdopen");
+        close(fd);
+        return nullptr;
+    }
+    setvbuf(file, nullptr, _IOFBF, 1 << 16);
+
+    if (dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+        perror("dup2");
+        fclose(file);
+        return nullptr;
+    }
+
+    return file;
+}
+
+/* See Session.h. */
+Inputter *createInputter(const std::string &scriptFile, std::string &commands)
+{
+    if (!scriptFile.empty()) {
+        FILE *file = fopen(scriptFile.c_str(), "r");
+        if (!file) {
+            perror(scriptFile.c_str());
+            return nullptr;
+        }
+        return new Inputter{file, scriptFile};
+    } else if (!commands.empty()) {
+        FILE *file = fmemopen(&commands[0], commands.size(), "r");
+        if (!file) {
+            perror("fmemopen");
+            return nullptr;
+        }
+        return new Inputter{file, "<command line>"};
+    } else if (!isatty(STDIN_FILENO))
+        return new Inputter{stdin, "<stdin>"};
+    else
+        return new Inputter;
+}
+
+/**
+ * Replace the tracee with a spare. The old tracee is killed once nothing refers
+ * to it, and the labels pointing into its code are forgotten.
+ * @return Zero on success, positive if there's no tracee to replace it with, in
+ * which case the old one is kept.
+ */
+static int resetTracee(std::shared_ptr<Tracee> &tracee, SpareTracees &spares,
+                       Assembler &assembler)
+{
+    std::shared_ptr<Tracee> fresh{spares.take()};
+    if (!fresh)
+        return 1;
+    tracee = std::move(fresh);
+    assembler.clearLabels();
+
+    // Get the next spare ready now rather than when it's needed
+    spares.fill();
+    return 0;
+}
+
+/* See Session.h. */
+int runSession(Inputter &inputter, std::shared_ptr<Tracee> tracee,
+               SpareTracees &spares, Assembler &assembler, JsonWriter *json)
+{
+    // Whether any line failed, for the exit status of batch input
+    bool failed = false;
+
+    std::string line;
+    for (;;) {
+        if (!inputter.readLine(assembler.inBlock() ? "  ...> " : "asmase> ",
+                               line)) {
+            if (inputter.isInteractive())
+                printf("\n");
+            break;
+        }
+
+        if (isBuiltin(line)) {
+            beginRecord(json, "builtin", line);
+            int error = runBuiltin(line, *tracee, assembler, inputter, json);
+            if (error == BUILTIN_RESET)
+                error = resetTracee(tracee, spares, assembler);
+            endRecord(json, error == BUILTIN_QUIT ? 0 : error);
+            if (error == BUILTIN_QUIT)
+                break;
+            if (error)
+                failed = true;
+            if (error < 0)
+                break;
+        } else if (assembler.inBlock()) {
+            assembler.addBlockLine(line);
+        } else if (assembler.opensBlock(line)) {
+            assembler.beginImplicitBlock(line, inputter.currentLineno());
+        } else {
+            bytestring machineCode;
+            std::vector<DataSection> sections;
+            uint64_t address =
+                reinterpret_cast<uintptr_t>(tracee->getCodeAddress());
+            uint64_t dataEnd =
+                reinterpret_cast<uintptr_t>(tracee->getDataEnd());
+
+            beginRecord(json, "instruction", line);
+            int error = assembler.assembleInstruction(line, address, dataEnd,
+                                                      machineCode, sections,
+                                                      inputter);
+            if (error) {
+                endRecord(json, error);
+                failed = true;
+                continue;
+            }
+
+            error = runMachineCode(*tracee, line, machineCode, sections, json);
+            endRecord(json, error);
+            if (error)
+                failed = true;
+            if (error < 0)
+                break;
+        }
+
+        if (assembler.isBlockReady()) {
+            bytestring machineCode;
+            std::vector<DataSection> sections;
+            uint64_t address =
+                reinterpret_cast<uintptr_t>(tracee->getCodeAddress());
+            uint64_t dataEnd =
+                reinterpret_cast<uintptr_t>(tracee->getDataEnd());
+
+            beginRecord(json, "block", "block");
+            int error = assembler.assembleBlock(address, dataEnd, machineCode,
+                                                sections, inputter);
+            if (error) {
+                endRecord(json, error);
+                failed = true;
+                continue;
+            }
+
+            error = runMachineCode(*tracee, "block", machineCode, sections,
+                                   json);
+            endRecord(json, error);
+            if (error)
+                failed = true;
+            if (error < 0)
+                break;
+        }
+    }
+
+    if (!inputter.isInteractive() && assembler.inBlock()) {
+        fprintf(stderr, "%s: unterminated block at end of input\n",
+                inputter.currentFilename().c_str());
+        failed = true;
+    }
+
+    return (!inputter.isInteractive() && failed) ? 1 : 0;
+}
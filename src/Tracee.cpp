@@ -21,14 +21,23 @@
  */
 
 #include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <csignal>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <string>
 #include <utility>
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/personality.h>
 #include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 
 #include "RegisterInfo.h"
@@ -46,21 +55,115 @@ Tracee::categoryPrinters = {
 /* See Tracee.h. */
 int Tracee::executeInstruction(const bytestring &machineCode)
 {
-    unsigned char *shared = reinterpret_cast<unsigned char *>(sharedMemory);
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    unsigned char *scratch =
+        static_cast<unsigned char *>(sharedMemory) + sharedSize - pageSize;
     const bytestring &trapInstruction = getTrapInstruction();
 
-    if (machineCode.size() + trapInstruction.size() >= sharedSize) {
+    if (machineCode.size() + trapInstruction.size() > pageSize) {
         fprintf(stderr, "instruction too long\n");
         return 1;
     }
 
-    memcpy(shared, machineCode.c_str(), machineCode.size());
-    shared += machineCode.size();
-    memcpy(shared, trapInstruction.c_str(), trapInstruction.size());
+    memcpy(scratch, machineCode.c_str(), machineCode.size());
+    memcpy(scratch + machineCode.size(), trapInstruction.c_str(),
+           trapInstruction.size());
+
+    return runUntilTrap(scratch);
+}
+
+/* See Tracee.h. */
+int Tracee::executeCode(const bytestring &machineCode)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    unsigned char *code = static_cast<unsigned char *>(getCodeAddress());
+    const bytestring &trapInstruction = getTrapInstruction();
+
+    // The trap after the previous code gets overwritten
+    if (codeOffset + machineCode.size() + trapInstruction.size() >
+        sharedSize - pageSize - dataSize) {
+        fprintf(stderr, "code region is full\n");
+        return 1;
+    }
+
+    memcpy(code, machineCode.c_str(), machineCode.size());
+    memcpy(code + machineCode.size(), trapInstruction.c_str(),
+           trapInstruction.size());
+    codeOffset += machineCode.size();
+
+    // The measurement is best effort; counters may not be permitted
+    if (!countersOpened) {
+        counters.open(pid);
+        countersOpened = true;
+    }
+
+    lastRun = CodeRun{};
+    lastRun.address = reinterpret_cast<uintptr_t>(code);
+    lastRun.machineCode = machineCode;
+
+    uint64_t cyclesBefore, instructionsBefore;
+    bool measured = !counters.read(cyclesBefore, instructionsBefore);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int error = runUntilTrap(code, &lastRun);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    lastRun.nanoseconds = (end.tv_sec - start.tv_sec) * UINT64_C(1000000000) +
+                          end.tv_nsec - start.tv_nsec;
+    if (!error && measured &&
+        !counters.read(lastRun.cycles, lastRun.instructions)) {
+        lastRun.cycles -= cyclesBefore;
+        lastRun.instructions -= instructionsBefore;
+        lastRun.measured = true;
+    }
+
+    return error;
+}
+
+/* See Tracee.h. */
+void *Tracee::getDataEnd() const
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    return static_cast<unsigned char *>(sharedMemory) + sharedSize - pageSize -
+           dataSize;
+}
+
+/* See Tracee.h. */
+int Tracee::placeData(const std::vector<DataSection> &sections)
+{
+    unsigned char *codeEnd =
+        static_cast<unsigned char *>(sharedMemory) + codeOffset;
+
+    for (const DataSection &section : sections) {
+        unsigned char *dataEnd = static_cast<unsigned char *>(getDataEnd());
+        auto *start = reinterpret_cast<unsigned char *>(section.address);
+        const bytestring &contents = section.contents;
 
+        if (start < codeEnd || start > dataEnd ||
+            contents.size() > static_cast<size_t>(dataEnd - start)) {
+            fprintf(stderr, "code region is full\n");
+            return 1;
+        }
+
+        memcpy(start, contents.c_str(), contents.size());
+        dataSize += dataEnd - start;
+    }
+
+    return 0;
+}
+
+/* See Tracee.h. */
+int Tracee::runUntilTrap(void *pc, CodeRun *run)
+{
     int waitStatus;
 
-    if (setProgramCounter(sharedMemory))
+    // Until we know better, the tracee couldn't be run
+    CodeRun ignored;
+    if (!run)
+        run = &ignored;
+    run->stop = CodeRun::Stop::ERROR;
+
+    if (setProgramCounter(pc))
         return -1;
 
 retry:
@@ -79,15 +182,23 @@ retry:
     if (WIFEXITED(waitStatus)) {
         fprintf(stderr, "tracee exited with status %d\n",
             WEXITSTATUS(waitStatus));
+        run->stop = CodeRun::Stop::EXITED;
+        exited = true;
+        run->stopStatus = WEXITSTATUS(waitStatus);
         return -1;
     } else if (WIFSIGNALED(waitStatus)) {
         fprintf(stderr, "tracee was terminated (%s)\n",
             strsignal(WTERMSIG(waitStatus)));
+        run->stop = CodeRun::Stop::TERMINATED;
+        exited = true;
+        run->stopStatus = WTERMSIG(waitStatus);
         return -1;
     } else if (WIFSTOPPED(waitStatus)) {
         int signal = WSTOPSIG(waitStatus);
+        run->stopStatus = signal;
         switch (signal) {
             case SIGTRAP:
+                run->stop = CodeRun::Stop::TRAP;
                 break;
             case SIGWINCH:
                 // We don't want to be interrupted if the window changes size,
@@ -96,7 +207,8 @@ retry:
             default:
                 printf("tracee was stopped (%s)\n", 
                     strsignal(WSTOPSIG(waitStatus)));
-                return 0;
+                run->stop = CodeRun::Stop::SIGNAL;
+                return 1;
         }
     } else if (WIFCONTINUED(waitStatus)) {
         fprintf(stderr, "tracee continued\n");
@@ -109,6 +221,19 @@ retry:
     return 0;
 }
 
+/* See Tracee.h. */
+void Tracee::release()
+{
+    if (!exited) {
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        exited = true;
+    }
+
+    munmap(sharedMemory, sharedSize);
+    munmap(arena, arenaSize);
+}
+
 /* See Tracee.h. */
 void Tracee::printInstruction(const bytestring &machineCode)
 {
@@ -121,6 +246,307 @@ void Tracee::printInstruction(const bytestring &machineCode)
     printf("]");
 }
 
+/* See Tracee.h. */
+bool Tracee::inArena(const void *address, size_t size) const
+{
+    auto start = static_cast<const unsigned char *>(arena);
+    auto p = static_cast<const unsigned char *>(address);
+    return p >= start && size <= arenaSize &&
+           (size_t) (p - start) <= arenaSize - size;
+}
+
+/**
+ * Read memory from the tracee one word at a time with ptrace. This is the
+ * fallback for when process_vm_readv isn't available.
+ * @return Zero on success, nonzero on failure.
+ */
+static int peekMemory(pid_t pid, const unsigned char *address,
+                      unsigned char *buffer, size_t size)
+{
+    while (size > 0) {
+        size_t offset = reinterpret_cast<uintptr_t>(address) % sizeof(long);
+        const unsigned char *wordAddress = address - offset;
+        size_t amount = std::min(sizeof(long) - offset, size);
+
+        errno = 0;
+        long word = ptrace(PTRACE_PEEKDATA, pid, wordAddress, nullptr);
+        if (errno)
+            return 1;
+        memcpy(buffer, reinterpret_cast<unsigned char *>(&word) + offset,
+               amount);
+
+        address += amount;
+        buffer += amount;
+        size -= amount;
+    }
+
+    return 0;
+}
+
+/* See Tracee.h. */
+int Tracee::readMemory(const void *address, void *buffer, size_t size)
+{
+    // The arena is mapped in our address space, too
+    if (inArena(address, size)) {
+        memcpy(buffer, address, size);
+        return 0;
+    }
+
+    auto remote = static_cast<const unsigned char *>(address);
+    auto local = static_cast<unsigned char *>(buffer);
+
+    while (size > 0) {
+        struct iovec localIov = {local, size};
+        struct iovec remoteIov = {const_cast<unsigned char *>(remote), size};
+
+        ssize_t amount = process_vm_readv(pid, &localIov, 1, &remoteIov, 1, 0);
+        if (amount <= 0) {
+            if (amount == -1 && errno == ENOSYS)
+                return peekMemory(pid, remote, local, size);
+            return 1;
+        }
+
+        remote += amount;
+        local += amount;
+        size -= amount;
+    }
+
+    return 0;
+}
+
+/**
+ * Write memory in the tracee one word at a time with ptrace. This is much
+ * slower than process_vm_writev but can also write to read-only mappings.
+ * @return Zero on success, nonzero on failure.
+ */
+static int pokeMemory(pid_t pid, unsigned char *address,
+                      const unsigned char *buffer, size_t size)
+{
+    while (size > 0) {
+        // Align down to a word boundary and splice our data into the word
+        size_t offset = reinterpret_cast<uintptr_t>(address) % sizeof(long);
+        unsigned char *wordAddress = address - offset;
+        size_t amount = std::min(sizeof(long) - offset, size);
+        long word;
+
+        if (offset != 0 || amount < sizeof(long)) {
+            errno = 0;
+            word = ptrace(PTRACE_PEEKDATA, pid, wordAddress, nullptr);
+            if (errno) {
+                fprintf(stderr, "cannot access memory at address %p\n",
+                        static_cast<void *>(address));
+                return 1;
+            }
+        }
+        memcpy(reinterpret_cast<unsigned char *>(&word) + offset, buffer,
+               amount);
+
+        if (ptrace(PTRACE_POKEDATA, pid, wordAddress, word) == -1) {
+            fprintf(stderr, "cannot access memory at address %p\n",
+                    static_cast<void *>(address));
+            return 1;
+        }
+
+        address += amount;
+        buffer += amount;
+        size -= amount;
+    }
+
+    return 0;
+}
+
+/* See Tracee.h. */
+int Tracee::writeMemory(void *address, const void *buffer, size_t size)
+{
+    if (inArena(address, size)) {
+        memcpy(address, buffer, size);
+        return 0;
+    }
+
+    auto remote = static_cast<unsigned char *>(address);
+    auto local = static_cast<const unsigned char *>(buffer);
+
+    while (size > 0) {
+        struct iovec localIov = {const_cast<unsigned char *>(local), size};
+        struct iovec remoteIov = {remote, size};
+
+        ssize_t written = process_vm_writev(pid, &localIov, 1, &remoteIov, 1, 0);
+        if (written <= 0) {
+            // process_vm_writev respects page protections and may not be
+            // supported by the kernel, so fall back to ptrace for the rest
+            return pokeMemory(pid, remote, local, size);
+        }
+
+        remote += written;
+        local += written;
+        size -= written;
+    }
+
+    return 0;
+}
+
+/* See Tracee.h. */
+void *Tracee::allocateArena(size_t size)
+{
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    auto start = reinterpret_cast<uintptr_t>(arena);
+    auto end = start + arenaSize;
+
+    size = (size + pageSize - 1) & ~(pageSize - 1);
+
+    // First fit in the gaps between existing allocations
+    uintptr_t candidate = start;
+    for (auto &allocation : arenaAllocations) {
+        auto allocationStart = reinterpret_cast<uintptr_t>(allocation.first);
+        if (allocationStart - candidate >= size)
+            break;
+        candidate = allocationStart + allocation.second;
+    }
+
+    if (end - candidate < size)
+        return nullptr;
+
+    void *address = reinterpret_cast<void *>(candidate);
+    arenaAllocations[address] = size;
+    return address;
+}
+
+/* See Tracee.h. */
+int Tracee::freeArena(void *address)
+{
+    return arenaAllocations.erase(address) ? 0 : 1;
+}
+
+/* See Tracee.h. */
+int Tracee::injectSyscall(long number, const std::vector<long> &args,
+                          long &result)
+{
+    int error;
+
+    if (saveRegisters())
+        return 1;
+
+    error = setSyscallRegisters(number, args);
+    if (!error)
+        error = executeInstruction(getSyscallInstruction());
+    if (error < 0)
+        return error;
+    if (!error)
+        error = getSyscallResult(result);
+
+    if (restoreRegisters())
+        return -1;
+
+    return error;
+}
+
+/** Return whether a raw system call return value indicates an error. */
+static inline bool isSyscallError(long result)
+{
+    return result < 0 && result >= -4095;
+}
+
+/* See Tracee.h. */
+int Tracee::mapMemory(size_t size, int prot, int flags, int fd, off_t offset,
+                      void *&addressOut)
+{
+    long result;
+    int error;
+
+#ifdef SYS_mmap2
+    // mmap2 takes the offset in 4096-byte units regardless of the page size
+    error = injectSyscall(SYS_mmap2, {0, (long) size, prot, flags, fd,
+                                      (long) (offset / 4096)}, result);
+#else
+    error = injectSyscall(SYS_mmap, {0, (long) size, prot, flags, fd,
+                                     (long) offset}, result);
+#endif
+    if (error)
+        return error;
+
+    if (isSyscallError(result)) {
+        fprintf(stderr, "mmap: %s\n", strerror(-result));
+        return 1;
+    }
+
+    addressOut = reinterpret_cast<void *>(result);
+    mappings[addressOut] = size;
+    return 0;
+}
+
+/* See Tracee.h. */
+int Tracee::openFile(const std::string &path, int flags, int &fdOut)
+{
+    long result;
+    int error;
+
+    // The tracee needs to be able to see the path, so stage it in the arena
+    void *pathAddress = allocateArena(path.size() + 1);
+    if (!pathAddress) {
+        fprintf(stderr, "data arena is full\n");
+        return 1;
+    }
+    memcpy(pathAddress, path.c_str(), path.size() + 1);
+
+    error = injectSyscall(SYS_openat, {AT_FDCWD, (long) pathAddress, flags},
+                          result);
+    freeArena(pathAddress);
+    if (error)
+        return error;
+
+    if (isSyscallError(result)) {
+        fprintf(stderr, "%s: %s\n", path.c_str(), strerror(-result));
+        return 1;
+    }
+
+    fdOut = result;
+    return 0;
+}
+
+/* See Tracee.h. */
+int Tracee::closeFile(int fd)
+{
+    long result;
+    int error;
+
+    error = injectSyscall(SYS_close, {fd}, result);
+    if (error)
+        return error;
+
+    if (isSyscallError(result)) {
+        fprintf(stderr, "close: %s\n", strerror(-result));
+        return 1;
+    }
+
+    return 0;
+}
+
+/* See Tracee.h. */
+int Tracee::unmapMemory(void *address)
+{
+    long result;
+    int error;
+
+    auto it = mappings.find(address);
+    if (it == mappings.end()) {
+        fprintf(stderr, "%p was not mapped\n", address);
+        return 1;
+    }
+
+    error = injectSyscall(SYS_munmap, {(long) address, (long) it->second},
+                          result);
+    if (error)
+        return error;
+
+    if (isSyscallError(result)) {
+        fprintf(stderr, "munmap: %s\n", strerror(-result));
+        return 1;
+    }
+
+    mappings.erase(it);
+    return 0;
+}
+
 /* See Tracee.h. */
 std::shared_ptr<RegisterValue> Tracee::getRegisterValue(const std::string &regName)
 {
@@ -139,6 +565,25 @@ std::shared_ptr<RegisterValue> Tracee::getRegisterValue(const std::string &regNa
     }
 }
 
+/* See Tracee.h. */
+int Tracee::getRegisterValues(
+    RegisterCategory categories,
+    std::vector<std::pair<const RegisterDesc *,
+                          std::shared_ptr<RegisterValue>>> &valuesOut)
+{
+    valuesOut.clear();
+    if (updateRegisters())
+        return 1;
+
+    for (const RegisterDesc &reg : regInfo.registers) {
+        if (any(reg.category & categories)) {
+            valuesOut.emplace_back(&reg, std::shared_ptr<RegisterValue>{
+                                             reg.getValue(*registers)});
+        }
+    }
+    return 0;
+}
+
 /* See Tracee.h. */
 int Tracee::printGeneralPurposeRegisters()
 {
@@ -198,46 +643,375 @@ int Tracee::printRegisters(RegisterCategory categories)
     return all_error;
 }
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+/**
+ * Size of the executable memory shared with the tracee, including the scratch
+ * page.
+ */
+static const size_t CODE_SIZE = 16 * 1024 * 1024;
+
+/** Size of the data arena shared with the tracee. */
+static const size_t ARENA_SIZE = 64 * 1024 * 1024;
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/** Options for new tracees. */
+static TraceeConfig traceeConfig;
+
+/**
+ * Maximum number of slots after the configured address to try when it's
+ * taken by another tracee.
+ */
+static const unsigned int MAX_TRACEE_SLOTS = 8;
+
+/** Memory shared with a tracee and the memfd backing it, if any. */
+class SharedMapping {
+public:
+    void *address;
+    size_t size;
+
+    /** The memfd (close-on-exec), or -1 for anonymous shared memory. */
+    int fd;
+
+    SharedMapping() : address{MAP_FAILED}, size{0}, fd{-1} {}
+
+    ~SharedMapping()
+    {
+        if (fd != -1)
+            close(fd);
+    }
+
+    /** Unmap the memory and close the memfd. */
+    void destroy()
+    {
+        if (address != MAP_FAILED)
+            munmap(address, size);
+        address = MAP_FAILED;
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+    }
+};
+
+/**
+ * Create memory to share with a tracee. This is backed by a memfd when the
+ * kernel supports it (and anonymous shared memory otherwise) so that an exec'd
+ * tracee can map it, too, and it is mapped before forking so that it lives at
+ * the same address in the tracer and the tracee.
+ * @param address The address to map the memory at, or nullptr to let the
+ * kernel choose. Nothing is printed if the address is taken.
+ * @return Zero on success, nonzero on failure.
+ */
+static int createSharedMemory(const char *name, size_t size, int prot,
+                              void *address, SharedMapping &out)
+{
+    int flags = MAP_SHARED | (address ? MAP_FIXED_NOREPLACE : 0);
+    int fd = -1;
+
+#ifdef SYS_memfd_create
+    fd = syscall(SYS_memfd_create, name, MFD_CLOEXEC);
+    if (fd != -1 && ftruncate(fd, size) == -1) {
+        perror("ftruncate");
+        close(fd);
+        return 1;
+    }
+#else
+    (void)name;
+#endif
+
+    void *mapped = MAP_FAILED;
+    if (fd != -1) {
+        mapped = mmap(address, size, prot, flags, fd, 0);
+        if (mapped == MAP_FAILED) {
+            // E.g., memfds may not be executable; fall back to anonymous
+            // memory, which can't be shared with an exec'd tracee
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (mapped == MAP_FAILED)
+        mapped = mmap(address, size, prot, flags | MAP_ANONYMOUS, -1, 0);
+
+    if (mapped == MAP_FAILED) {
+        if (!address)
+            perror("mmap");
+        if (fd != -1)
+            close(fd);
+        return 1;
+    }
+
+    // Older kernels treat MAP_FIXED_NOREPLACE as a hint
+    if (address && mapped != address) {
+        munmap(mapped, size);
+        if (fd != -1)
+            close(fd);
+        return 1;
+    }
+
+    out.address = mapped;
+    out.size = size;
+    out.fd = fd;
+    return 0;
+}
+
+/**
+ * Create the memory shared with a new tracee: the code (including the scratch
+ * page) and the data arena after it, at the configured address if there is
+ * one.
+ * @return Zero on success, nonzero on failure.
+ */
+static int createTraceeMemory(SharedMapping &code, SharedMapping &arena)
+{
+    const int codeProt = PROT_READ | PROT_WRITE | PROT_EXEC;
+    const int arenaProt = PROT_READ | PROT_WRITE;
+
+    if (!traceeConfig.address) {
+        if (createSharedMemory("asmase-code", CODE_SIZE, codeProt, nullptr,
+                               code)) {
+            fprintf(stderr, "could not create shared memory\n");
+            return 1;
+        }
+        if (createSharedMemory("asmase-arena", ARENA_SIZE, arenaProt, nullptr,
+                               arena)) {
+            fprintf(stderr, "could not create data arena\n");
+            code.destroy();
+            return 1;
+        }
+        return 0;
+    }
+
+    for (unsigned int slot = 0; slot < MAX_TRACEE_SLOTS; ++slot) {
+        uintptr_t address =
+            traceeConfig.address + slot * (CODE_SIZE + ARENA_SIZE);
+        auto codeAddress = reinterpret_cast<void *>(address);
+        auto arenaAddress = reinterpret_cast<void *>(address + CODE_SIZE);
+
+        if (createSharedMemory("asmase-code", CODE_SIZE, codeProt,
+                               codeAddress, code))
+            continue;
+        if (createSharedMemory("asmase-arena", ARENA_SIZE, arenaProt,
+                               arenaAddress, arena)) {
+            code.destroy();
+            continue;
+        }
+        return 0;
+    }
+
+    fprintf(stderr, "no room for a tracee at 0x%" PRIx64 "\n",
+            traceeConfig.address);
+    return 1;
+}
+
+/** Get the path of the tracee stub, which is installed next to asmase. */
+static const std::string &getStubPath()
+{
+    static const std::string path = []() {
+        char buffer[PATH_MAX];
+        ssize_t ret = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+        if (ret == -1)
+            return std::string{};
+        std::string exe{buffer, static_cast<size_t>(ret)};
+        size_t slash = exe.rfind('/');
+        if (slash == std::string::npos)
+            return std::string{};
+        return exe.substr(0, slash + 1) + "asmase-tracee";
+    }();
+    return path;
+}
+
 /** Entry point for the tracee. Request to be ptraced and trap immediately. */
 static void traceeProcess() __attribute__((noreturn));
 
+/**
+ * Close every file descriptor from 3 up except the given ones. A tracee can
+ * outlive whatever forked it, so it mustn't keep anything else open (e.g., a
+ * socket, which would keep the peer from seeing EOF). This is called in a
+ * child after fork(), so it doesn't allocate memory.
+ */
+static void closeInheritedFds(int keepFd1, int keepFd2);
+
+/** Entry point for a tracee which execs the stub with the given arguments. */
+static void execTraceeStub(char **argv, int codeFd, int arenaFd)
+    __attribute__((noreturn));
+
+/**
+ * Wait for a new tracee to stop itself.
+ * @param reapedOut Set to whether the tracee exited (or was killed) and was
+ * reaped while waiting, in which case its PID may already be reused.
+ * @return Zero on success, nonzero on failure.
+ */
+static int waitForTraceeStart(pid_t pid, bool &reapedOut);
+
 /** Set up an signal handlers needed by the tracer. */
 static void installTracerSignalHandlers();
 
-/* See Tracee.h. */
-std::shared_ptr<Tracee> Tracee::createTracee()
+/**
+ * Fork a tracee and wait for it to stop itself. If stubPath is given, the
+ * child execs the stub, which maps the shared memory from its memfds;
+ * otherwise, the child inherits the mappings.
+ * @return The PID of the tracee, or -1 on failure.
+ */
+static pid_t startTracee(const SharedMapping &code, const SharedMapping &arena,
+                         const std::string *stubPath)
 {
-    pid_t pid;
-    void *sharedPage;
-    size_t pageSize = sysconf(_SC_PAGESIZE);
+    // Everything the child needs is prepared before forking, since it can't
+    // safely allocate memory if another thread is running
+    std::vector<std::string> args;
+    std::vector<char *> argv;
+    if (stubPath) {
+        args = {
+            *stubPath,
+            std::to_string(code.fd),
+            std::to_string(reinterpret_cast<uintptr_t>(code.address)),
+            std::to_string(code.size),
+            std::to_string(arena.fd),
+            std::to_string(reinterpret_cast<uintptr_t>(arena.address)),
+            std::to_string(arena.size),
+        };
+        for (std::string &arg : args)
+            argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
 
-    sharedPage = mmap(nullptr, pageSize, PROT_READ | PROT_WRITE | PROT_EXEC,
-                      MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+    if (pid == 0) {
+        // Neither of these returns
+        if (stubPath)
+            execTraceeStub(argv.data(), code.fd, arena.fd);
+        traceeProcess();
+    }
 
-    if (!sharedPage) {
-        perror("mmap");
-        fprintf(stderr, "could not create shared memory\n");
-        return {nullptr};
+    // Wait for the tracee to stop itself so that it's ready to be traced as
+    // soon as it's returned
+    bool reaped;
+    if (waitForTraceeStart(pid, reaped)) {
+        if (!reaped) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+        return -1;
     }
+    return pid;
+}
 
-    if ((pid = fork()) == -1) {
-        perror("fork");
-        fprintf(stderr, "could not fork tracee\n");
+/* See Tracee.h. */
+void Tracee::configure(const TraceeConfig &config)
+{
+    traceeConfig = config;
+}
+
+/* See Tracee.h. */
+std::shared_ptr<Tracee> Tracee::createTracee()
+{
+    SharedMapping code, arena;
+    if (createTraceeMemory(code, arena))
         return {nullptr};
-    }
 
-    if (pid == 0)
-        traceeProcess(); // This never returns
+    pid_t pid = -1;
+
+    // The stub keeps the tracee small and its layout the same between builds;
+    // if it's missing or fails, fork as usual
+    const std::string &stubPath = getStubPath();
+    if (traceeConfig.useStub && code.fd != -1 && arena.fd != -1 &&
+        !stubPath.empty() && access(stubPath.c_str(), X_OK) == 0)
+        pid = startTracee(code, arena, &stubPath);
+
+    if (pid == -1) {
+        pid = startTracee(code, arena, nullptr);
+        if (pid == -1) {
+            fprintf(stderr, "could not start tracee\n");
+            code.destroy();
+            arena.destroy();
+            return {nullptr};
+        }
+
+        // A forked tracee keeps our layout, randomized or not
+        static bool warned = false;
+        if (traceeConfig.noRandomize && !warned) {
+            fprintf(stderr,
+                    "--no-aslr has no effect without the tracee stub\n");
+            warned = true;
+        }
+    }
 
     installTracerSignalHandlers();
 
-    Tracee *platformTracee = createPlatformTracee(pid, sharedPage, pageSize);
+    Tracee *platformTracee =
+        createPlatformTracee(pid, code.address, code.size, arena.address,
+                             arena.size);
     return std::shared_ptr<Tracee>{platformTracee};
 }
 
+/* See above. */
+static void execTraceeStub(char **argv, int codeFd, int arenaFd)
+{
+    closeInheritedFds(codeFd, arenaFd);
+
+    // The memfds are close-on-exec so that nothing else inherits them
+    fcntl(codeFd, F_SETFD, 0);
+    fcntl(arenaFd, F_SETFD, 0);
+
+    if (traceeConfig.noRandomize) {
+        int persona = personality(0xffffffff);
+        if (persona != -1)
+            personality(persona | ADDR_NO_RANDOMIZE);
+    }
+
+    execv(argv[0], argv);
+    _exit(127);
+}
+
+/**
+ * Close the file descriptors from first to last, inclusive, without
+ * allocating memory.
+ */
+static void closeFdRange(unsigned int first, unsigned int last)
+{
+    if (first > last)
+        return;
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, first, last, 0) == 0)
+        return;
+#endif
+
+    // Without close_range(), no descriptor can be above the limit
+    struct rlimit rlim;
+    unsigned int max = 1 << 20;
+    if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur != RLIM_INFINITY)
+        max = std::min<rlim_t>(rlim.rlim_cur, max);
+    for (unsigned int fd = first; fd <= last && fd < max; ++fd)
+        close(fd);
+}
+
+/* See above. */
+static void closeInheritedFds(int keepFd1, int keepFd2)
+{
+    int keep[] = {std::min(keepFd1, keepFd2), std::max(keepFd1, keepFd2)};
+    unsigned int next = 3;
+    for (int fd : keep) {
+        if (fd < 0 || static_cast<unsigned int>(fd) < next)
+            continue;
+        closeFdRange(next, fd - 1);
+        next = fd + 1;
+    }
+    closeFdRange(next, UINT_MAX);
+}
+
 /* See above. */
 static void traceeProcess()
 {
+    closeInheritedFds(-1, -1);
+
     if (ptrace(PTRACE_TRACEME, -1, nullptr, nullptr) == -1) {
         perror("ptrace");
         abort();
@@ -252,6 +1026,27 @@ static void traceeProcess()
     abort();
 }
 
+/* See above. */
+static int waitForTraceeStart(pid_t pid, bool &reapedOut)
+{
+    reapedOut = false;
+    for (;;) {
+        int waitStatus;
+        if (waitpid(pid, &waitStatus, 0) == -1)
+            return 1;
+        if (!WIFSTOPPED(waitStatus)) {
+            reapedOut = WIFEXITED(waitStatus) || WIFSIGNALED(waitStatus);
+            return 1;
+        }
+        if (WSTOPSIG(waitStatus) == SIGTRAP)
+            return 0;
+
+        // Another signal (e.g., SIGWINCH) got there first, so discard it
+        if (ptrace(PTRACE_CONT, pid, nullptr, 0) == -1)
+            return 1;
+    }
+}
+
 /* See above. */
 static void installTracerSignalHandlers()
 {
@@ -263,3 +1058,25 @@ static void installTracerSignalHandlers()
     // Ignore SIGINT so the user can break out of the tracee
     sigaction(SIGINT, &act, nullptr);
 }
+
+/* See Tracee.h. */
+void SpareTracees::fill()
+{
+    while (spares.size() < count) {
+        std::shared_ptr<Tracee> tracee{Tracee::createTracee()};
+        if (!tracee)
+            break;
+        spares.push_back(std::move(tracee));
+    }
+}
+
+/* See Tracee.h. */
+std::shared_ptr<Tracee> SpareTracees::take()
+{
+    if (spares.empty())
+        return Tracee::createTracee();
+
+    std::shared_ptr<Tracee> tracee{std::move(spares.back())};
+    spares.pop_back();
+    return tracee;
+}
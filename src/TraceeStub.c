@@ -0,0 +1,113 @@
+/*
+ * Minimal process which is exec'd to become a tracee.
+ *
+ * Copyright (C) 2013-2016 Omar Sandoval
+ *
+ * This file is part of asmase.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * This is built as a small static binary so that a tracee doesn't inherit
+ * asmase's address space. It maps the memory shared with the tracer at the
+ * same addresses as the tracer, asks to be traced, and stops itself; from then
+ * on, it only runs code injected by the tracer. See Tracee::createTracee().
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/**
+ * Parse a number argument.
+ * @return Zero on success, nonzero on failure.
+ */
+static int parseNumber(const char *str, unsigned long long *valueOut)
+{
+    char *end;
+
+    errno = 0;
+    *valueOut = strtoull(str, &end, 0);
+    return errno || *end || end == str;
+}
+
+/**
+ * Map memory shared with the tracer. The arguments are the file descriptor
+ * backing the memory, its address, and its size. The memory must end up at
+ * exactly the same address as in the tracer.
+ * @return Zero on success, nonzero on failure.
+ */
+static int mapShared(char **args, int prot)
+{
+    unsigned long long fd, address, size;
+    void *mapped;
+
+    if (parseNumber(args[0], &fd) || parseNumber(args[1], &address) ||
+        parseNumber(args[2], &size)) {
+        fprintf(stderr, "asmase-tracee: invalid mapping %s %s %s\n", args[0],
+                args[1], args[2]);
+        return 1;
+    }
+
+    // Older kernels treat MAP_FIXED_NOREPLACE as a hint, so check where the
+    // memory ended up
+    mapped = mmap((void *) (uintptr_t) address, size, prot,
+                  MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        perror("asmase-tracee: mmap");
+        return 1;
+    }
+    if (mapped != (void *) (uintptr_t) address) {
+        fprintf(stderr, "asmase-tracee: %#llx is already in use\n", address);
+        munmap(mapped, size);
+        return 1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 7) {
+        fprintf(stderr,
+                "usage: %s CODE_FD CODE_ADDRESS CODE_SIZE "
+                "ARENA_FD ARENA_ADDRESS ARENA_SIZE\n", argv[0]);
+        return 2;
+    }
+
+    if (mapShared(&argv[1], PROT_READ | PROT_WRITE | PROT_EXEC) ||
+        mapShared(&argv[4], PROT_READ | PROT_WRITE))
+        return 1;
+
+    if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) == -1) {
+        perror("asmase-tracee: ptrace");
+        return 1;
+    }
+
+    raise(SIGTRAP);
+
+    // We shouldn't make it here, but if we do...
+    abort();
+}
@@ -19,22 +19,36 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <getopt.h>
-#include <iomanip>
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
 
 #include "Assembler.h"
-#include "Builtins.h"
+#include "Daemon.h"
 #include "Inputter.h"
-#include "Support.h"
+#include "JsonWriter.h"
+#include "Pool.h"
+#include "Session.h"
 #include "Tracee.h"
 
 static const char *progname;
 
 void usage(bool error)
 {
-    fprintf(error ? stderr : stdout, "Usage: %s [-hv]\n", progname);
+    fprintf(error ? stderr : stdout,
+            "Usage: %s [-hv] [--mcpu=CPU] [--mattr=FEATURES] [--output=FORMAT]\n"
+            "       [--socket=PATH] [--no-daemon] [-f FILE | -e LINE...]\n"
+            "       %s -j JOBS [--mcpu=CPU] [--mattr=FEATURES] [--output=FORMAT]\n"
+            "       FILE|DIR...\n"
+            "       %s --daemon [--mcpu=CPU] [--mattr=FEATURES] [--socket=PATH]\n",
+            progname, progname, progname);
 }
 
 void version()
@@ -47,19 +61,40 @@ void version()
         ASMASE_VERSION);
 }
 
+
 int main(int argc, char *argv[])
 {
     int c;
+    std::string cpu, features;
+    std::string scriptFile, commands;
+    bool jsonOutput = false;
+    bool daemon = false, useDaemon = true;
+    std::string socketPath;
+    bool parallel = false;
+    unsigned int jobs = 0;
+    TraceeConfig traceeConfig;
 
     static struct option long_options[] = {
-        {"version", no_argument, nullptr, 'v'},
-        {"help",    no_argument, nullptr, 'h'},
+        {"version",   no_argument,       nullptr, 'v'},
+        {"help",      no_argument,       nullptr, 'h'},
+        {"mcpu",      required_argument, nullptr, 'c'},
+        {"mattr",     required_argument, nullptr, 'a'},
+        {"file",      required_argument, nullptr, 'f'},
+        {"execute",   required_argument, nullptr, 'e'},
+        {"output",    required_argument, nullptr, 'o'},
+        {"daemon",    no_argument,       nullptr, 'D'},
+        {"no-daemon", no_argument,       nullptr, 'N'},
+        {"socket",    required_argument, nullptr, 'S'},
+        {"jobs",      required_argument, nullptr, 'j'},
+        {"tracee-address", required_argument, nullptr, 'A'},
+        {"no-aslr",        no_argument,       nullptr, 'R'},
+        {nullptr,     0,                 nullptr, 0},
     };
 
     progname = argv[0];
 
     for (;;) {
-        c = getopt_long(argc, argv, "vh", long_options, nullptr);
+        c = getopt_long(argc, argv, "vhf:e:j:", long_options, nullptr);
         if (c == -1)
             break;
 
@@ -71,8 +106,94 @@ int main(int argc, char *argv[])
             printf("asmase assembly REPL %s\n\n", ASMASE_VERSION);
             usage(false);
             printf("\n");
+            printf("Options:\n");
+            printf("  --mcpu=CPU         assemble for CPU instead of the host CPU\n");
+            printf("  --mattr=FEATURES   enable (+feature) or disable (-feature) a comma-separated\n"
+                   "                     list of target features\n");
+            printf("  -f, --file=FILE    run FILE non-interactively and exit\n");
+            printf("  -e, --execute=LINE run LINE non-interactively and exit; may be repeated\n");
+            printf("  --output=FORMAT    write results as text (the default) or as json, one\n"
+                   "                     record per line on stdout\n");
+            printf("  --daemon           keep the assembler and spare tracees warm and run -f and\n"
+                   "                     -e input for other invocations of asmase\n");
+            printf("  --socket=PATH      socket for the daemon (default: %s)\n",
+                   getDefaultSocketPath().c_str());
+            printf("  --no-daemon        run -f and -e input in-process even if a daemon is running\n");
+            printf("  -j, --jobs=JOBS    run the given scripts (or the files in the given\n"
+                   "                     directories) JOBS at a time, or one per CPU if JOBS is\n"
+                   "                     0, and write their output in order\n");
+            printf("  --tracee-address=ADDR\n"
+                   "                     map the tracee's code at ADDR and its data arena right\n"
+                   "                     after it\n");
+            printf("  --no-aslr          disable address space randomization in the tracee\n");
+            printf("\n");
+            printf("Piped input is also run non-interactively. The exit status is nonzero if any\n"
+                   "line failed to assemble or run when running non-interactively.\n");
+            printf("\n");
             printf("For more information, type `:help` from within asmase, or consult the README.\n");
             return 0;
+        case 'c':
+            cpu = optarg;
+            break;
+        case 'a':
+            features = optarg;
+            break;
+        case 'f':
+            scriptFile = optarg;
+            break;
+        case 'e':
+            commands += optarg;
+            commands += '\n';
+            break;
+        case 'o':
+            if (strcmp(optarg, "json") == 0)
+                jsonOutput = true;
+            else if (strcmp(optarg, "text") == 0)
+                jsonOutput = false;
+            else {
+                fprintf(stderr, "%s: unknown output format '%s'\n", progname,
+                        optarg);
+                return 2;
+            }
+            break;
+        case 'D':
+            daemon = true;
+            break;
+        case 'N':
+            useDaemon = false;
+            break;
+        case 'S':
+            socketPath = optarg;
+            break;
+        case 'j': {
+            char *end;
+            errno = 0;
+            unsigned long value = strtoul(optarg, &end, 10);
+            if (errno || *end || end == optarg || value > UINT_MAX) {
+                fprintf(stderr, "%s: invalid number of jobs '%s'\n",
+                        progname, optarg);
+                return 2;
+            }
+            parallel = true;
+            jobs = value;
+            break;
+        }
+        case 'A': {
+            char *end;
+            errno = 0;
+            unsigned long long value = strtoull(optarg, &end, 0);
+            if (errno || *end || end == optarg || value == 0 ||
+                value % sysconf(_SC_PAGESIZE)) {
+                fprintf(stderr, "%s: invalid tracee address '%s'\n",
+                        progname, optarg);
+                return 2;
+            }
+            traceeConfig.address = value;
+            break;
+        }
+        case 'R':
+            traceeConfig.noRandomize = true;
+            break;
         case '?':
         default:
             usage(true);
@@ -80,48 +201,84 @@ int main(int argc, char *argv[])
         }
     }
 
-    version();
+    if ((optind < argc) != parallel ||
+        (!scriptFile.empty() && !commands.empty()) ||
+        (parallel && (!scriptFile.empty() || !commands.empty() || daemon)) ||
+        (daemon && (!scriptFile.empty() || !commands.empty() || jsonOutput))) {
+        usage(true);
+        return 2;
+    }
 
-    std::shared_ptr<Tracee> tracee{Tracee::createTracee()};
-    if (!tracee)
-        return 1;
+    // Pool workers inherit this when they're forked. A daemon's tracees are
+    // laid out the way it was told to lay them out.
+    Tracee::configure(traceeConfig);
+    if (traceeConfig.address || traceeConfig.noRandomize)
+        useDaemon = false;
 
-    Inputter inputter;
+    if (parallel) {
+        std::vector<std::string> paths{argv + optind, argv + argc};
+        return runScripts(paths, jobs, cpu, features, jsonOutput);
+    }
 
-    std::shared_ptr<AssemblerContext>
-        assemblerContext{Assembler::createAssemblerContext()};
-    if (!assemblerContext)
-        return 1;
-    Assembler assembler{assemblerContext};
+    if (socketPath.empty())
+        socketPath = getDefaultSocketPath();
 
-    for (;;) {
-        std::string line = inputter.readLine("asmase> ");
-        if (line.empty()) {
-            printf("\n");
-            break;
-        }
+    if (daemon)
+        return runDaemon(socketPath, cpu, features);
 
-        line.resize(line.size() - 1); // Trim off the newline
+    if (useDaemon && (!scriptFile.empty() || !commands.empty())) {
+        DaemonRequest request;
+        request.cpu = cpu;
+        request.features = features;
+        request.scriptFile = scriptFile;
+        request.commands = commands;
+        request.jsonOutput = jsonOutput;
 
-        if (isBuiltin(line)) {
-            if (runBuiltin(line, *tracee, inputter) < 0)
-                break;
-        } else {
-            bytestring machineCode;
+        int status;
+        if (!runOnDaemon(socketPath, request, status))
+            return status;
+    }
 
-            int error = assembler.assembleInstruction(line, machineCode, inputter);
-            if (error || machineCode.empty())
-                continue;
+    std::unique_ptr<Inputter> inputterPtr{createInputter(scriptFile, commands)};
+    if (!inputterPtr)
+        return 1;
+    Inputter &inputter = *inputterPtr;
 
-            printf("%s = ", line.c_str());
-            tracee->printInstruction(machineCode);
-            printf("\n");
+    std::unique_ptr<JsonWriter> json;
+    if (jsonOutput) {
+        FILE *jsonFile = openJsonOutput();
+        if (!jsonFile)
+            return 1;
+        json.reset(new JsonWriter{jsonFile});
+    }
 
-            error = tracee->executeInstruction(machineCode);
-            if (error < 0)
-                break;
-        }
+    if (inputter.isInteractive())
+        version();
+    else {
+        // Nobody is watching the output as it's produced, so buffer all of
+        // it. This has to happen before anything is printed.
+        static char outputBuffer[1 << 16];
+        setvbuf(stdout, outputBuffer, _IOFBF, sizeof(outputBuffer));
     }
 
-    return 0;
+    std::shared_ptr<Tracee> tracee{Tracee::createTracee()};
+    if (!tracee)
+        return 1;
+
+    // Keep a spare ready for :reset in interactive sessions. Batch input
+    // rarely resets, so it forks one if it needs to.
+    SpareTracees spares{inputter.isInteractive() ? 1U : 0U};
+    spares.fill();
+
+    // Set up LLVM while we wait for the first line of input. The tracees are
+    // created first so that we don't fork with another thread running.
+    Assembler assembler{
+        Assembler::createAssemblerContextAsync(cpu, features)};
+
+    // Like :source, this is only an optimization, so it's fine if it fails
+    if (!scriptFile.empty())
+        assembler.loadScript(scriptFile);
+
+    return runSession(inputter, std::move(tracee), spares, assembler,
+                      json.get());
 }
@@ -0,0 +1,13 @@
+# :alloc. Each check jumps over a ud2 when the value is right, so a wrong value
+# fails the line.
+
+# Mapping memory runs a system call in the tracee, which must not clobber the
+# registers that the system call uses
+mov $1, %rax; mov $2, %rcx; mov $3, %r11; mov $4, %rdi
+:alloc 4096 populate
+cmp $1, %rax; jne 2f; cmp $2, %rcx; jne 2f; cmp $3, %r11; jne 2f; cmp $4, %rdi; je 1f; 2: ud2; 1:
+:alloc 4096 thp
+cmp $1, %rax; jne 2f; cmp $2, %rcx; jne 2f; cmp $3, %r11; jne 2f; cmp $4, %rdi; je 1f; 2: ud2; 1:
+
+# Allocations too big for the data arena are mapped instead
+:alloc 0x8000000
@@ -0,0 +1,26 @@
+# options: --tracee-address=0x200000000
+# Allocations from the data arena, which comes right after the 16MB of code at
+# the tracee address. Freeing fails unless the address was allocated, and each
+# check jumps over a ud2 when the value is right, so a wrong value fails the
+# line.
+
+# Allocations are rounded up to a page and go in the first gap that fits
+:alloc 64
+:alloc 64
+:free 0x201000000
+:alloc 4096
+:free 0x201001000
+:free 0x201000000
+:alloc 8192
+:alloc 64
+:free 0x201002000
+:free 0x201000000
+
+# The arena is shared with the tracee
+:alloc 8
+:write 0x201000000 0x1122334455667788
+movabs 0x201000000, %rax; movabs $0x1122334455667788, %rcx; cmp %rcx, %rax; je 1f; ud2; 1:
+movabs $0x8877665544332211, %rax; movabs %rax, 0x201000000
+:fill 0x201000008 8 0xff
+movabs 0x201000000, %rax; movabs $0x8877665544332211, %rcx; cmp %rcx, %rax; jne 2f; movabs 0x201000008, %rax; cmp $-1, %rax; je 1f; 2: ud2; 1:
+:free 0x201000000
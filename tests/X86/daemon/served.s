@@ -0,0 +1,3 @@
+# The daemon runs at the lowest priority, so this fails unless the daemon ran
+# it: getpriority() returns 20 minus the nice value.
+mov $140, %eax; xor %edi, %edi; xor %esi, %esi; syscall; cmp $1, %rax; je 1f; ud2; 1:
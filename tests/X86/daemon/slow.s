@@ -0,0 +1,3 @@
+# This keeps the daemon busy while another request is made.
+mov $140, %eax; xor %edi, %edi; xor %esi, %esi; syscall; cmp $1, %rax; je 1f; ud2; 1:
+movabs $3000000000, %rcx; 1: dec %rcx; jnz 1b
@@ -0,0 +1,27 @@
+# Symbol definitions carried from line to line. Each check jumps over a ud2
+# when the value is right, so a wrong value fails the line.
+
+# A counter which is assigned over and over
+n = 0
+n = n + 1
+n = n + 1
+.set n, n + 1
+mov $n, %eax; cmp $3, %eax; je 1f; ud2; 1:
+
+# Definitions in a false conditional aren't made
+.if 0
+n = 100
+.endif
+mov $n, %eax; cmp $3, %eax; je 1f; ud2; 1:
+
+# Definitions in a repeated block are made once per repetition
+.rept 4
+n = n + 1
+.endr
+mov $n, %eax; cmp $7, %eax; je 1f; ud2; 1:
+
+# A macro which uses a symbol sees its latest value
+.macro load_n reg; mov $n, \reg; .endm
+n = 10
+load_n %eax
+cmp $10, %eax; je 1f; ud2; 1:
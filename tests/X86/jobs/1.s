@@ -0,0 +1,4 @@
+# This finishes last when run concurrently with the others, but its output has
+# to come first.
+movabs $1000000000, %rcx; 1: dec %rcx; jnz 1b
+:print 1
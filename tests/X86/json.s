@@ -0,0 +1,11 @@
+# status: 1
+# Every line outside of a block gets a JSON record, including comments and
+# blank lines, and an implicit block gets one when it ends. json.records has
+# the type and status of each record.
+
+mov $42, %rax
+:print 1
+bogus_instruction
+.rept 2
+nop
+.endr
@@ -0,0 +1,38 @@
+# :write, :fill, and :fill-random. Each check jumps over a ud2 when memory
+# holds what was written, so a wrong value fails the line.
+
+sub $64, %rsp
+
+# Integers are stored using the current size, which defaults to g (8 bytes)
+:write $rsp 0x1122334455667788
+movabs $0x1122334455667788, %rax; cmp %rax, (%rsp); je 1f; ud2; 1:
+
+# A size specifier applies to the values after it
+:write $rsp b 1 2 h 0x0403 w 0x08070605
+movabs $0x0807060504030201, %rax; cmp %rax, (%rsp); je 1f; ud2; 1:
+
+# Floating point numbers are stored as a float or a double, and strings are
+# stored byte for byte
+:write $rsp w 1.5 "abcd"
+cmpl $0x3fc00000, (%rsp); jne 2f; cmpl $0x64636261, 4(%rsp); je 1f; 2: ud2; 1:
+:write $rsp 1.5
+movabs $0x3ff8000000000000, %rax; cmp %rax, (%rsp); je 1f; ud2; 1:
+
+# The fill pattern is a byte by default
+:fill $rsp 16 0xab
+movabs $0xabababababababab, %rax; cmp %rax, (%rsp); jne 2f; cmp %rax, 8(%rsp); je 1f; 2: ud2; 1:
+
+# or an integer of the given size, or a string
+:fill $rsp 8 0x1234 h
+movabs $0x1234123412341234, %rax; cmp %rax, (%rsp); je 1f; ud2; 1:
+:fill $rsp 8 "ab"
+movabs $0x6261626162616261, %rax; cmp %rax, (%rsp); je 1f; ud2; 1:
+
+# The same seed always generates the same data, and another seed doesn't
+:fill-random $rsp 32 7
+:fill-random ($rsp + 32) 32 7
+mov %rsp, %rsi; lea 32(%rsp), %rdi; mov $32, %rcx; cld; repe cmpsb; je 1f; ud2; 1:
+:fill-random ($rsp + 32) 32 8
+mov %rsp, %rsi; lea 32(%rsp), %rdi; mov $32, %rcx; cld; repe cmpsb; jne 1f; ud2; 1:
+
+add $64, %rsp
@@ -0,0 +1,11 @@
+# Relocations resolved by the capture streamer. Each check jumps over a ud2
+# when the value is right, so a wrong value fails the line.
+
+# Absolute reference to a label defined on the same line, at a nonzero offset
+nop; foo: movabs $foo, %rax
+lea foo(%rip), %rcx
+cmp %rcx, %rax; je 1f; ud2; 1:
+
+# PC-relative reference to a data symbol at a nonzero offset in its section
+.data; x: .quad 1; y: .quad 2; .text; mov y(%rip), %rax
+cmp $2, %rax; je 1f; ud2; 1:
@@ -0,0 +1,13 @@
+# :reset. Each check jumps over a ud2 when the value is right, so a wrong value
+# fails the line.
+
+mov $0x5eed5eed, %rbx
+:reset
+
+# The new tracee doesn't have the old one's registers, but it runs code as
+# usual
+cmp $0x5eed5eed, %rbx; jne 1f; ud2; 1:
+mov $42, %rax
+cmp $42, %rax; je 1f; ud2; 1:
+:reset
+cmp $42, %rax; jne 1f; ud2; 1:
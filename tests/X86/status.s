@@ -0,0 +1,7 @@
+# status: 1
+# A line that fails to assemble makes the exit status 1, but the lines after
+# it still run.
+
+mov $1, %rax
+bogus_instruction %rax
+cmp $1, %rax; je 1f; ud2; 1:
@@ -0,0 +1,4 @@
+The shell reads this line before asmase starts, so asmase must not run it.
+# Input read from standard input starts where the descriptor's position is,
+# even when the input is a file that gets mapped.
+nop
@@ -0,0 +1,106 @@
+#!/bin/sh
+
+# Run each test script for an architecture non-interactively; a script passes
+# if every line in it assembles and runs. A "# options: ..." line in a script
+# gives extra command line options to run it with, and a "# status: N" line
+# makes it pass only if asmase exits with status N instead. If there is a
+# NAME.records file next to NAME.s, the script is also run with --output=json,
+# and the type and status of each record must match the lines of the file.
+# The scripts in the stdin directory are run from standard input after the
+# shell has read their first line. The scripts in the daemon directory are run
+# by a daemon, with served.s run while slow.s is still running. The scripts in
+# the jobs directory are run concurrently with -j, which must give the same
+# output as running them one after another.
+# Usage: tests/run.sh ASMASE ARCH
+
+asmase="$1"
+arch="$2"
+failed=0
+
+# Print whether a test passed and remember if it didn't.
+# Usage: report NAME STATUS EXPECTED_STATUS
+report() {
+    if [ "$2" -eq "$3" ]; then
+        echo "PASS $1"
+    else
+        echo "FAIL $1 (exit status $2, expected $3)"
+        failed=1
+    fi
+}
+
+# Run asmase in-process with the given options and check its exit status.
+# Error messages are expected when the status is nonzero, so they're hidden.
+# Usage: check NAME EXPECTED_STATUS [OPTION...]
+check() {
+    name="$1"
+    expected="$2"
+    shift 2
+    if [ "$expected" -eq 0 ]; then
+        "$asmase" --no-daemon "$@" > /dev/null
+    else
+        "$asmase" --no-daemon "$@" > /dev/null 2>&1
+    fi
+    report "$name" $? "$expected"
+}
+
+for test in tests/"$arch"/*.s; do
+    [ -e "$test" ] || continue
+    options=$(sed -n 's/^# options: //p' "$test")
+    status=$(sed -n 's/^# status: //p' "$test")
+    check "$test" "${status:-0}" $options -f "$test"
+
+    records="${test%.s}.records"
+    if [ -e "$records" ]; then
+        "$asmase" --no-daemon $options --output=json -f "$test" 2> /dev/null |
+            sed -n 's/^{"type":"\([a-z]*\)".*"status":"\([a-z]*\)"}$/\1 \2/p' |
+            cmp -s - "$records"
+        report "$test (JSON)" $? 0
+    fi
+done
+
+for test in tests/"$arch"/stdin/*.s; do
+    [ -e "$test" ] || continue
+    { read -r line; "$asmase" --no-daemon > /dev/null; } < "$test"
+    report "$test" $? 0
+done
+
+if [ -e tests/"$arch"/daemon/slow.s ]; then
+    dir=$(mktemp -d)
+    socket="$dir/socket"
+    nice -n 19 "$asmase" --daemon --socket="$socket" 2> /dev/null &
+    daemon=$!
+    tries=0
+    while [ ! -S "$socket" ] && [ $tries -lt 100 ]; do
+        sleep 0.1
+        tries=$((tries + 1))
+    done
+
+    "$asmase" --socket="$socket" -f tests/"$arch"/daemon/slow.s > /dev/null &
+    slow=$!
+    sleep 0.2
+    "$asmase" --socket="$socket" -f tests/"$arch"/daemon/served.s > /dev/null
+    report tests/"$arch"/daemon/served.s $? 0
+    kill -0 $slow 2> /dev/null
+    report "daemon requests run concurrently" $? 0
+    wait $slow
+    report tests/"$arch"/daemon/slow.s $? 0
+
+    kill $daemon
+    wait $daemon 2> /dev/null
+    rm -rf "$dir"
+fi
+
+if [ -d tests/"$arch"/jobs ]; then
+    expected=$(for test in tests/"$arch"/jobs/*.s; do
+        "$asmase" --no-daemon -f "$test"
+    done)
+    output=$("$asmase" -j 3 tests/"$arch"/jobs) && [ "$output" = "$expected" ]
+    report tests/"$arch"/jobs $? 0
+fi
+
+# Lines given with -e behave like lines in a script
+check "-e" 0 -e 'nop' -e ':print 1'
+check "-e with an error" 1 -e 'bogus_instruction' -e 'nop'
+check "-e and -f together" 2 -e 'nop' -f /dev/null
+
+exit $failed